@@ -0,0 +1,246 @@
+#include "game.h"
+
+#include <string.h>
+#include "hal.h"
+
+//  ******************************************
+//     Speed settings
+//  ******************************************
+struct game_speed {
+    int scroll_speed; // ms
+    int jump_dur; // ms
+};
+
+const struct game_speed game_speeds[SPEED_LEVELS] PROGMEM = {
+    {300, 500},
+    {200, 380},
+    {100, 180},
+    {40, 90}
+};
+
+int game_speed_scroll_ms(uint8_t level) {
+    return pgm_read_word(&game_speeds[level].scroll_speed);
+}
+
+int game_speed_jump_ms(uint8_t level) {
+    return pgm_read_word(&game_speeds[level].jump_dur);
+}
+
+//  ******************************************
+//     World generation
+//  ******************************************
+//
+//  Obstacles come from a 16-bit xorshift generator: three shifts and xors
+//  per cell, and a threshold compare for the obstacle rate, where rand() % 10
+//  costs a 32-bit multiply and a division. The low bits of the same number
+//  pick the obstacle type. The same seed gives the same map.
+//  After an obstacle at least min_gap empty cells follow, enough to land
+//  from a tap and take off again, so no map asks for the impossible.
+//
+//  Designed maps are streamed from flash instead. Each byte of a level is
+//  LEVEL(gap, type): gap (0-31) empty cells, then one obstacle of the given
+//  type. LEVEL_EMPTY adds nothing after the gap, for runs longer than 31.
+//  LEVEL_END starts the level over, so a level is endless and costs about
+//  two bytes of flash per screen. Only the decoder position lives in SRAM.
+//  Level gaps are the author's responsibility: 4 cells clear every speed.
+#define WORLD_SEED 0xACE1 // Any nonzero value
+#define WORLD_OBSTACLE_RATE 6554 // Out of 65536, i.e. 10% of the free cells
+
+#define LEVEL(gap, type) (((gap) << 3) | (type))
+#define LEVEL_END 0
+#define LEVEL_EMPTY 0
+#define LEVEL_CACTUS OBSTACLE_CACTUS // Types are the cell codes, 1-7
+#define LEVEL_ROCK OBSTACLE_ROCK
+#define LEVEL_STUMP OBSTACLE_STUMP
+
+//  Obstacle types by the low bits of the random number: mostly cacti
+const uint8_t world_obstacles[4] PROGMEM = {
+    OBSTACLE_CACTUS, OBSTACLE_ROCK, OBSTACLE_CACTUS, OBSTACLE_STUMP
+};
+
+const uint8_t level_warm_up[] PROGMEM = {
+    LEVEL(12, LEVEL_CACTUS), LEVEL(10, LEVEL_CACTUS), LEVEL(10, LEVEL_CACTUS),
+    LEVEL(8, LEVEL_CACTUS), LEVEL(31, LEVEL_EMPTY), LEVEL(8, LEVEL_CACTUS),
+    LEVEL(8, LEVEL_CACTUS), LEVEL(6, LEVEL_CACTUS), LEVEL(12, LEVEL_CACTUS),
+    LEVEL_END
+};
+
+const uint8_t level_rhythm[] PROGMEM = {
+    LEVEL(8, LEVEL_CACTUS), LEVEL(6, LEVEL_ROCK), LEVEL(6, LEVEL_CACTUS),
+    LEVEL(6, LEVEL_ROCK), LEVEL(12, LEVEL_CACTUS), LEVEL(5, LEVEL_ROCK),
+    LEVEL(5, LEVEL_CACTUS), LEVEL(5, LEVEL_ROCK), LEVEL(5, LEVEL_CACTUS),
+    LEVEL(14, LEVEL_ROCK), LEVEL(7, LEVEL_CACTUS), LEVEL(5, LEVEL_ROCK),
+    LEVEL(7, LEVEL_CACTUS), LEVEL(5, LEVEL_ROCK),
+    LEVEL_END
+};
+
+const uint8_t level_sprint[] PROGMEM = {
+    LEVEL(6, LEVEL_STUMP), LEVEL(4, LEVEL_CACTUS), LEVEL(4, LEVEL_ROCK),
+    LEVEL(9, LEVEL_CACTUS), LEVEL(4, LEVEL_STUMP), LEVEL(5, LEVEL_CACTUS),
+    LEVEL(4, LEVEL_ROCK), LEVEL(4, LEVEL_CACTUS), LEVEL(10, LEVEL_STUMP),
+    LEVEL(4, LEVEL_CACTUS), LEVEL(4, LEVEL_ROCK), LEVEL(4, LEVEL_CACTUS),
+    LEVEL(4, LEVEL_STUMP), LEVEL(12, LEVEL_CACTUS),
+    LEVEL_END
+};
+
+const uint8_t *const level_maps[LEVEL_MAPS] PROGMEM = {
+    level_warm_up,
+    level_rhythm,
+    level_sprint
+};
+
+void game_init(struct game *g) {
+    memset(g, 0, sizeof(*g));
+    g->rng = WORLD_SEED;
+    game_set_speed(g, 0);
+    game_reset(g, 0);
+}
+
+//  Marsaglia's xorshift16 (7, 9, 8). A nonzero state never becomes zero.
+static uint16_t world_random(struct game *g) {
+    uint16_t x = g->rng;
+    x ^= x << 7;
+    x ^= x >> 9;
+    x ^= x << 8;
+    return g->rng = x;
+}
+
+//  Start the obstacle sequence of a map. The multiply spreads neighbouring
+//  seeds ('1', '2', ...) apart before the first cell.
+void world_seed(struct game *g, uint16_t seed) {
+    g->rng = seed * 0x9E37 + 0x79B9;
+    if (g->rng == 0) g->rng = WORLD_SEED;
+}
+
+//  Menu option 'c': a designed level, or a seed for the generator
+void world_select_map(struct game *g, uint8_t map) {
+    if (map >= '1' && map < '1' + LEVEL_MAPS) {
+        g->level_start = pgm_read_ptr(&level_maps[map - '1']);
+    }
+    else {
+        g->level_start = 0;
+        world_seed(g, map);
+    }
+}
+
+//  Decode the next cell of the level
+static uint8_t level_next(struct game *g) {
+    while (g->level_run == 0 && g->level_item == LEVEL_EMPTY) {
+        uint8_t code = pgm_read_byte(g->level_pos++);
+        if (code == LEVEL_END) {
+            g->level_pos = g->level_start;
+            continue;
+        }
+        g->level_run = code >> 3;
+        g->level_item = code & 0x07;
+    }
+    if (g->level_run) {
+        g->level_run--;
+        return EMPTY_CELL;
+    }
+    uint8_t item = g->level_item;
+    g->level_item = LEVEL_EMPTY;
+    return item;
+}
+
+//  The next cell to enter the lookahead
+static uint8_t world_generate(struct game *g) {
+    if (g->level_start) return level_next(g);
+    if (g->gap >= g->min_gap) {
+        uint16_t r = world_random(g);
+        if (r < WORLD_OBSTACLE_RATE) {
+            g->gap = 0;
+            return pgm_read_byte(&world_obstacles[r & 3]);
+        }
+    }
+    if (g->gap < UINT8_MAX) g->gap++;
+    return EMPTY_CELL;
+}
+
+//  Move everything one column left and generate the cell that becomes the
+//  end of the lookahead. It lands in the slot that just left the screen.
+static void world_scroll(struct game *g) {
+    g->head = (g->head + 1) & (WORLD_SIZE - 1);
+    g->world[(g->head + WORLD_VIEW + WORLD_LOOKAHEAD - 1) & (WORLD_SIZE - 1)] = world_generate(g);
+    g->scrolled++;
+}
+
+//  ******************************************
+//     Rules
+//  ******************************************
+void game_set_speed(struct game *g, uint8_t level) {
+    g->scroll_speed = game_speed_scroll_ms(level);
+    g->jump_dur = game_speed_jump_ms(level);
+    // A tap keeps the runner up for jump_dur, i.e. this many scrolls. It
+    // needs one more cell to land on, and applies to cells generated from
+    // now on.
+    g->min_gap = (g->jump_dur + g->scroll_speed - 1) / g->scroll_speed + 1;
+}
+
+void game_reset(struct game *g, unsigned long now) {
+    g->head = 0;
+    g->scrolled = 0;
+    g->gap = WORLD_VIEW; // The screen starts empty
+    g->level_pos = g->level_start;
+    g->level_run = 0;
+    g->level_item = LEVEL_EMPTY;
+    for (uint8_t col = 0; col < WORLD_SIZE; col++) {
+        g->world[col] = EMPTY_CELL;
+    }
+    for (uint8_t col = WORLD_VIEW; col < WORLD_VIEW + WORLD_LOOKAHEAD; col++) {
+        g->world[col] = world_generate(g);
+    }
+    g->airborne = 0;
+    g->score = 0;
+    g->next_scroll_ms = now + g->scroll_speed;
+    g->jump_end_ms = now;
+}
+
+uint8_t game_step(struct game *g, unsigned long now, uint8_t select_held) {
+    uint8_t result = 0;
+    if (deadline_reached(now, g->next_scroll_ms)) {
+        g->next_scroll_ms = now + g->scroll_speed;
+        world_scroll(g);
+        if (!g->airborne) g->score++;
+        result |= GAME_MOVED;
+    }
+
+    // Holding SELECT keeps the runner up
+    if (select_held) {
+        if (!g->airborne) result |= GAME_MOVED;
+        g->airborne = 1;
+        g->jump_end_ms = now + g->jump_dur;
+    }
+    else if (g->airborne && deadline_reached(now, g->jump_end_ms)) {
+        g->airborne = 0; // Land
+        result |= GAME_MOVED;
+    }
+    // On the ground, an obstacle in the runner's column is the end
+    if (!g->airborne && is_obstacle(world_cell(g, RUNNER_COL))) result |= GAME_OVER;
+    return result;
+}
+
+//  The next scroll, or the landing if the runner is in the air and SELECT
+//  is up
+unsigned long game_deadline(const struct game *g, uint8_t select_held) {
+    unsigned long deadline = g->next_scroll_ms;
+    if (g->airborne && !select_held && (long) (g->jump_end_ms - deadline) < 0) {
+        deadline = g->jump_end_ms;
+    }
+    return deadline;
+}
+
+//  The runner leaves the ground at the press and stays up while SELECT is
+//  held. The press can be older than the last game_step(): the jump still
+//  counts from it.
+uint8_t game_press(struct game *g, unsigned long when) {
+    uint8_t result = g->airborne ? 0 : GAME_MOVED;
+    g->airborne = 1;
+    g->jump_end_ms = when + g->jump_dur;
+    return result;
+}
+
+//  The runner comes down jump_dur after the release
+void game_release(struct game *g, unsigned long now) {
+    if (g->airborne) g->jump_end_ms = now + g->jump_dur;
+}
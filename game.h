@@ -0,0 +1,109 @@
+#ifndef GAME_H
+#define GAME_H
+
+//  ******************************************
+//     Game rules
+//  ******************************************
+//
+//  Scrolling, obstacle generation, the jump and collisions, with all their
+//  state in one struct game and no hardware underneath. The firmware runs
+//  one game against the clock and the buttons. Host tools run as many as
+//  they like, on as many threads as they like.
+//
+//  Times are in milliseconds on whatever clock the caller keeps. Speeds
+//  come from a table of SPEED_LEVELS settings. The firmware's pot and LCD
+//  labels index the same table.
+
+#include <stdint.h>
+
+//  Cell codes. Obstacle types only differ in looks; the renderer gives each
+//  its own glyph, and an empty cell is a space.
+#define EMPTY_CELL 32
+#define OBSTACLE_CACTUS 1
+#define OBSTACLE_ROCK 2
+#define OBSTACLE_STUMP 3
+#define OBSTACLE_TYPES 3 // Codes OBSTACLE_CACTUS and up
+
+//  The ground row is a ring buffer of WORLD_SIZE cells. head is the cell at
+//  the left edge of the screen, so scrolling is a single increment however
+//  wide the world is. The WORLD_LOOKAHEAD cells past the right edge are
+//  generated ahead of time and scroll into view one per tick.
+#define WORLD_SIZE 32 // Must be a power of two
+#define WORLD_VIEW 16 // LCD columns
+#define WORLD_LOOKAHEAD 8 // Generated cells past the right edge
+#define RUNNER_COL 1
+
+#if WORLD_VIEW + WORLD_LOOKAHEAD > WORLD_SIZE
+#error "The screen and lookahead don't fit in WORLD_SIZE"
+#endif
+
+#define SPEED_LEVELS 4
+#define LEVEL_MAPS 3 // Designed maps '1' to '3'; the other digits are procedural
+
+//  game_step() results
+#define GAME_MOVED 0x01 // Something on screen changed
+#define GAME_OVER 0x02 // The runner hit an obstacle
+
+struct game {
+    uint8_t world[WORLD_SIZE];
+    uint8_t head;
+    uint8_t scrolled; // Counts every scroll; the runner strides in step
+
+    // Procedural generator
+    uint16_t rng;
+    uint8_t gap; // Empty cells generated since the last obstacle
+    uint8_t min_gap;
+
+    // Designed level, if level_start isn't 0
+    const uint8_t *level_start;
+    const uint8_t *level_pos;
+    uint8_t level_run; // Empty cells left before level_item
+    uint8_t level_item;
+
+    int scroll_speed; // ms per column
+    int jump_dur; // ms in the air after SELECT comes up
+    uint8_t airborne;
+    int score; // Only counts scrolls spent on the ground
+    unsigned long next_scroll_ms;
+    unsigned long jump_end_ms;
+};
+
+//  Deadlines compare through a signed difference, so they keep working when
+//  the clock wraps (every ~49 days for millis, ~71 minutes for micros).
+static inline uint8_t deadline_reached(unsigned long now, unsigned long deadline) {
+    return (long) (now - deadline) >= 0;
+}
+
+static inline uint8_t is_obstacle(uint8_t cell) {
+    return (uint8_t) (cell - OBSTACLE_CACTUS) < OBSTACLE_TYPES;
+}
+
+//  Cell at a column counted from the left edge of the screen
+static inline uint8_t world_cell(const struct game *g, uint8_t col) {
+    return g->world[(g->head + col) & (WORLD_SIZE - 1)];
+}
+
+void game_init(struct game *g);
+void world_seed(struct game *g, uint16_t seed);
+void world_select_map(struct game *g, uint8_t map);
+void game_set_speed(struct game *g, uint8_t level);
+int game_speed_scroll_ms(uint8_t level);
+int game_speed_jump_ms(uint8_t level);
+
+//  New round at time now: empty screen, fresh lookahead, runner on the
+//  ground, score 0. Designed levels start over; the generator carries on.
+void game_reset(struct game *g, unsigned long now);
+
+//  Advance to time now with SELECT held or not. Returns GAME_MOVED and
+//  GAME_OVER flags. Calling it early is harmless; game_deadline() says when
+//  it next has something to do without new input.
+uint8_t game_step(struct game *g, unsigned long now, uint8_t select_held);
+unsigned long game_deadline(const struct game *g, uint8_t select_held);
+
+//  SELECT went down at time when. Returns GAME_MOVED if the runner took off.
+uint8_t game_press(struct game *g, unsigned long when);
+
+//  SELECT came up at time now
+void game_release(struct game *g, unsigned long now);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef HAL_H
+#define HAL_H
+
+//  ******************************************
+//     Hardware abstraction layer
+//  ******************************************
+//
+//  main.c reads and writes the ATmega328P registers by name. Most of that
+//  works unchanged against any backend that provides the registers as
+//  variables; what doesn't is anything with a side effect beyond the stored
+//  value: waiting, strobing a pin, clearing an interrupt flag (write 1 to
+//  clear) and the UART and ADC data registers. Those go through the hal_*
+//  operations below.
+//
+//  On AVR every operation is a macro for the exact register access it
+//  replaces, so the firmware compiles to the same code as before. Any other
+//  target gets the host backend in host/, which simulates the peripherals
+//  against a virtual clock.
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+
+//  Delays. Arguments must be compile-time constants, as for _delay_ms().
+#define hal_delay_ms(ms) _delay_ms(ms)
+#define hal_delay_us(us) _delay_us(us)
+
+//  Pulse an output high for 1 us and back low (LCD enable, >= 450 ns).
+#define hal_gpio_strobe(port, bit) do { \
+    (port) |= (1 << (bit)); \
+    _delay_us(1); \
+    (port) &= ~(1 << (bit)); \
+} while (0)
+
+//  Clear an interrupt flag; AVR flags clear by writing a one.
+#define hal_clear_flag(reg, bit) ((reg) = (1 << (bit)))
+
+#define hal_timer2_count() TCNT2
+#define hal_adc_read() ADC
+#define hal_uart_write(data) (UDR0 = (data))
+#define hal_uart_read() UDR0
+
+//  Called in the body of every busy-wait. The hardware keeps running on its
+//  own, so on AVR there is nothing to do.
+#define hal_spin() do {} while (0)
+
+#else
+
+#include "host/hal_host.h"
+
+#endif
+
+#endif
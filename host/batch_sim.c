@@ -0,0 +1,293 @@
+//  ******************************************
+//     Batch simulator
+//  ******************************************
+//
+//  Plays rounds of the game rules in game.c headlessly, on every core, to
+//  put numbers on the speed table. Each round at each speed level is played
+//  by two policies:
+//      optimal   taps SELECT (press, tap_ms, release) at the best moment,
+//                knowing every generated cell. It never double-jumps: it
+//                only presses after landing. When no tap can clear what is
+//                coming, the death is unavoidable.
+//      player    aims for the middle of the window of presses that clear the
+//                next obstacle, and presses up to +-error ms off it,
+//                uniformly, like a player with imperfect timing.
+//  Holding SELECT clears anything, so unavoidable here means unavoidable
+//  with single jumps. Rounds end at a death or after max_scrolls.
+//
+//  Output per speed level: the probability of an unavoidable death within a
+//  round, and the player's survival curve, i.e. the fraction of rounds
+//  still going after n scrolls.
+//
+//      cc -std=gnu99 -O2 -pthread -o batch-sim host/batch_sim.c game.c
+//      ./batch-sim [-n rounds] [-t threads] [-e error_ms] [-p tap_ms]
+//                  [-s max_scrolls] [-m map]
+//
+//  Maps are as in menu option 'c': '1'-'3' are the designed levels, and any
+//  other map gives every round its own seed for the generator.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../game.h"
+
+#define SIM_MIN_GROUND_MS 10 // Time on the ground between jumps, one event tick
+#define SIM_NEVER 0xFFFFFFFFUL
+#define SIM_POLICIES 2
+#define SIM_OPTIMAL 0
+#define SIM_PLAYER 1
+
+const unsigned long checkpoints[] = {25, 50, 100, 200, 500, 1000, 2000, 5000};
+#define CHECKPOINTS (sizeof(checkpoints) / sizeof(checkpoints[0]))
+
+struct sim_config {
+    unsigned long rounds;
+    unsigned threads;
+    unsigned error_ms;
+    unsigned tap_ms;
+    unsigned long max_scrolls;
+    uint8_t map;
+};
+
+struct sim_result {
+    unsigned long unavoidable;
+    unsigned long *deaths; // Per policy: deaths after n scrolls, [0, max_scrolls)
+    unsigned long long steps;
+};
+
+struct sim_job {
+    const struct sim_config *config;
+    uint8_t level;
+    unsigned long first_round;
+    unsigned long rounds;
+    struct sim_result result[SIM_POLICIES];
+    pthread_t thread;
+};
+
+//  xorshift32 for the player's timing errors, one per thread
+static uint32_t sim_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+//  When the obstacle in column col reaches the runner
+static unsigned long arrival(const struct game *g, uint8_t col) {
+    return g->next_scroll_ms + (unsigned long) (col - RUNNER_COL - 1) * g->scroll_speed;
+}
+
+//  The arrival of the obstacle that a landing at time land would put the
+//  runner on, or SIM_NEVER
+static unsigned long landing_obstacle(const struct game *g, unsigned long land) {
+    for (uint8_t col = RUNNER_COL + 1; col < WORLD_VIEW + WORLD_LOOKAHEAD; col++) {
+        if (!is_obstacle(world_cell(g, col))) continue;
+        unsigned long a = arrival(g, col);
+        if (land >= a && land < a + g->scroll_speed) return a;
+    }
+    return SIM_NEVER;
+}
+
+//  When to press for the next obstacle. Presses from *press to *latest
+//  clear it without landing on another; the optimal policy takes *press,
+//  as an earlier landing leaves more room for the next jump. *press is
+//  SIM_NEVER with nothing in sight. Returns 0 if no tap clears it, leaving
+//  the last press that would have in both.
+static int plan(const struct game *g, unsigned long now, unsigned tap_ms, unsigned long *press, unsigned long *latest) {
+    *press = *latest = SIM_NEVER;
+    uint8_t col = RUNNER_COL + 1;
+    while (col < WORLD_VIEW + WORLD_LOOKAHEAD && !is_obstacle(world_cell(g, col))) col++;
+    if (col == WORLD_VIEW + WORLD_LOOKAHEAD) return 1;
+
+    unsigned long airtime = tap_ms + g->jump_dur;
+    unsigned long first = arrival(g, col);
+    // Wait until every cell the jump could land on has been generated
+    if (first + airtime >= arrival(g, WORLD_VIEW + WORLD_LOOKAHEAD)) return 1;
+    unsigned long p = now;
+    if (first + g->scroll_speed > p + airtime) p = first + g->scroll_speed - airtime;
+    while (p <= first) {
+        unsigned long a = landing_obstacle(g, p + airtime);
+        if (a == SIM_NEVER) break;
+        p = a + g->scroll_speed - airtime; // Land as it leaves
+    }
+    if (p > first) {
+        *press = *latest = first;
+        return 0;
+    }
+
+    // Later presses work until the landing reaches the next obstacle
+    unsigned long last = first;
+    for (col = RUNNER_COL + 1; col < WORLD_VIEW + WORLD_LOOKAHEAD; col++) {
+        if (!is_obstacle(world_cell(g, col))) continue;
+        unsigned long a = arrival(g, col);
+        if (a > p + airtime && a - airtime - 1 < last) last = a - airtime - 1;
+    }
+    *press = p;
+    *latest = last;
+    return 1;
+}
+
+//  Play one round. Returns the number of scrolls survived, and sets
+//  *unavoidable if the optimal policy found no way through.
+static unsigned long sim_round(struct game *g, const struct sim_config *config, int policy,
+                               uint32_t *rng, int *unavoidable, unsigned long long *steps) {
+    unsigned long now = 0, scrolls = 0;
+    unsigned long press_at = SIM_NEVER, release_at = SIM_NEVER;
+    uint8_t select = 0;
+
+    game_reset(g, now);
+    *unavoidable = 0;
+    while (scrolls < config->max_scrolls) {
+        if (!g->airborne && !select && press_at == SIM_NEVER) {
+            unsigned long earliest = now + SIM_MIN_GROUND_MS, latest;
+            if (!plan(g, earliest, config->tap_ms, &press_at, &latest)) {
+                *unavoidable = 1;
+                if (policy == SIM_OPTIMAL) return scrolls;
+            }
+            if (press_at != SIM_NEVER && policy == SIM_PLAYER) {
+                // Aim for the middle of the window
+                long error = (long) (sim_random(rng) % (2 * config->error_ms + 1)) - (long) config->error_ms;
+                press_at += (latest - press_at) / 2;
+                press_at = (long) (press_at - earliest) + error < 0 ? earliest : press_at + error;
+            }
+        }
+
+        unsigned long next = game_deadline(g, select);
+        if (press_at != SIM_NEVER && (long) (press_at - next) < 0) next = press_at;
+        if (release_at != SIM_NEVER && (long) (release_at - next) < 0) next = release_at;
+        now = next;
+        if (now == press_at) {
+            select = 1;
+            press_at = SIM_NEVER;
+            release_at = now + config->tap_ms;
+        }
+        else if (now == release_at) {
+            select = 0;
+            release_at = SIM_NEVER;
+            game_release(g, now);
+        }
+
+        if (deadline_reached(now, g->next_scroll_ms)) scrolls++;
+        (*steps)++;
+        if (game_step(g, now, select) & GAME_OVER) return scrolls;
+    }
+    return scrolls;
+}
+
+static void *sim_thread(void *arg) {
+    struct sim_job *job = arg;
+    const struct sim_config *config = job->config;
+    struct game g;
+    uint32_t rng = 0x9E3779B9 ^ (uint32_t) job->first_round;
+    if (!rng) rng = 1;
+
+    for (int policy = 0; policy < SIM_POLICIES; policy++) {
+        struct sim_result *result = &job->result[policy];
+        game_init(&g);
+        game_set_speed(&g, job->level);
+        if (config->map >= '1' && config->map < '1' + LEVEL_MAPS) world_select_map(&g, config->map);
+        for (unsigned long round = job->first_round; round < job->first_round + job->rounds; round++) {
+            int unavoidable;
+            if (!g.level_start) world_seed(&g, (uint16_t) round);
+            unsigned long scrolls = sim_round(&g, config, policy, &rng, &unavoidable, &result->steps);
+            if (policy == SIM_OPTIMAL) result->unavoidable += unavoidable;
+            if (scrolls < config->max_scrolls) result->deaths[scrolls]++;
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n rounds] [-t threads] [-e error_ms] [-p tap_ms] [-s max_scrolls] [-m map]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    struct sim_config config = {100000, 0, 60, 50, 2000, 'r'};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:e:p:s:m:")) != -1) {
+        switch (opt) {
+            case 'n': config.rounds = strtoul(optarg, NULL, 0); break;
+            case 't': config.threads = strtoul(optarg, NULL, 0); break;
+            case 'e': config.error_ms = strtoul(optarg, NULL, 0); break;
+            case 'p': config.tap_ms = strtoul(optarg, NULL, 0); break;
+            case 's': config.max_scrolls = strtoul(optarg, NULL, 0); break;
+            case 'm': config.map = optarg[0]; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!config.rounds || !config.max_scrolls || !config.tap_ms) usage(argv[0]);
+    if (!config.threads) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        config.threads = cores > 0 ? cores : 1;
+    }
+    if (config.threads > config.rounds) config.threads = config.rounds;
+
+    printf("%lu rounds per speed, up to %lu scrolls, %u ms taps, player timing error +-%u ms, map %c\n",
+           config.rounds, config.max_scrolls, config.tap_ms, config.error_ms, config.map);
+    printf("%-6s %6s %5s %12s   player still going after n scrolls\n", "level", "scroll", "jump", "unavoidable");
+    printf("%-6s %6s %5s %12s  ", "", "ms", "ms", "deaths");
+    for (unsigned c = 0; c < CHECKPOINTS && checkpoints[c] <= config.max_scrolls; c++) printf(" %6lu", checkpoints[c]);
+    printf("\n");
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long long steps = 0;
+    struct sim_job *jobs = calloc(config.threads, sizeof(*jobs));
+    for (uint8_t level = 0; level < SPEED_LEVELS; level++) {
+        for (unsigned t = 0; t < config.threads; t++) {
+            struct sim_job *job = &jobs[t];
+            memset(job, 0, sizeof(*job));
+            job->config = &config;
+            job->level = level;
+            job->first_round = config.rounds * t / config.threads;
+            job->rounds = config.rounds * (t + 1) / config.threads - job->first_round;
+            for (int policy = 0; policy < SIM_POLICIES; policy++) {
+                job->result[policy].deaths = calloc(config.max_scrolls, sizeof(unsigned long));
+            }
+            pthread_create(&job->thread, NULL, sim_thread, job);
+        }
+
+        unsigned long unavoidable = 0, optimal_deaths = 0;
+        unsigned long *deaths = calloc(config.max_scrolls, sizeof(unsigned long));
+        for (unsigned t = 0; t < config.threads; t++) {
+            struct sim_job *job = &jobs[t];
+            pthread_join(job->thread, NULL);
+            unavoidable += job->result[SIM_OPTIMAL].unavoidable;
+            for (unsigned long n = 0; n < config.max_scrolls; n++) {
+                deaths[n] += job->result[SIM_PLAYER].deaths[n];
+                optimal_deaths += job->result[SIM_OPTIMAL].deaths[n];
+            }
+            for (int policy = 0; policy < SIM_POLICIES; policy++) {
+                steps += job->result[policy].steps;
+                free(job->result[policy].deaths);
+            }
+        }
+
+        printf("%-6u %6d %5d %12.6f  ", level, game_speed_scroll_ms(level), game_speed_jump_ms(level),
+               (double) unavoidable / config.rounds);
+        unsigned long dead = 0, n = 0;
+        for (unsigned c = 0; c < CHECKPOINTS && checkpoints[c] <= config.max_scrolls; c++) {
+            for (; n < checkpoints[c] && n < config.max_scrolls; n++) dead += deaths[n];
+            printf(" %6.4f", 1 - (double) dead / config.rounds);
+        }
+        printf("\n");
+        free(deaths);
+        // The optimal policy only stops where it saw no way through
+        if (optimal_deaths != unavoidable) {
+            fprintf(stderr, "level %u: optimal policy died %lu times, expected %lu\n", level, optimal_deaths, unavoidable);
+        }
+    }
+    free(jobs);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    unsigned long total = config.rounds * SPEED_LEVELS * SIM_POLICIES;
+    printf("%lu rounds, %llu steps in %.2f s on %u threads: %.0f rounds/s, %.1fM steps/s\n",
+           total, steps, seconds, config.threads, total / seconds, steps / seconds / 1e6);
+    return 0;
+}
@@ -0,0 +1,546 @@
+//  ******************************************
+//     Host backend: simulated ATmega328P peripherals
+//  ******************************************
+//
+//  Time is counted in CPU cycles. hal_host_run() moves it forward event by
+//  event: each step runs up to the next timer match or overflow, ADC result
+//  or UART byte, raises that peripheral's flag, and then dispatches pending
+//  interrupts in vector order if SREG's I bit is set. An ISR runs with I
+//  clear, so waits inside it advance the peripherals but never nest.
+//
+//  Only the parts of each peripheral main.c uses are modelled: normal, CTC
+//  and fast PWM modes of the 8-bit timers, normal mode of Timer1, single and
+//  free-running ADC conversions, the USART's data register empty and
+//  receive complete flags, and pin change interrupts on port C.
+
+#define _DEFAULT_SOURCE
+#include "hal_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+
+volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+volatile uint8_t ADCSRA, ADCSRB, ADMUX, DIDR0;
+volatile uint16_t ADC;
+volatile uint8_t UCSR0A = (1 << UDRE0), UCSR0B, UCSR0C = (3 << UCSZ00), UDR0;
+volatile uint16_t UBRR0;
+volatile uint8_t SREG;
+volatile uint8_t SMCR;
+volatile uint8_t PCICR, PCMSK1, PCIFR;
+
+//  Rough costs in cycles of the things virtual time is charged for
+#define SPIN_CYCLES 16 // One pass of a busy-wait loop
+#define ATOMIC_CYCLES 16 // An atomic block, i.e. one multi-byte snapshot
+#define ISR_CYCLES 40 // Interrupt entry, register saves and reti
+
+#define NEVER UINT64_MAX
+
+static uint64_t now = 0;
+static uint64_t sleep_cycles = 0; // Time spent in sleep_cpu()
+static uint32_t isr_calls = 0;
+
+//  Interrupt vectors the firmware may or may not define
+#define VECTOR(name) extern void name(void) __attribute__((weak));
+VECTOR(PCINT1_vect)
+VECTOR(TIMER2_COMPA_vect)
+VECTOR(TIMER2_OVF_vect)
+VECTOR(TIMER1_COMPA_vect)
+VECTOR(TIMER1_OVF_vect)
+VECTOR(TIMER0_COMPA_vect)
+VECTOR(USART_RX_vect)
+VECTOR(USART_UDRE_vect)
+VECTOR(ADC_vect)
+
+//  ******************************************
+//     Timers
+//  ******************************************
+static const uint16_t timer01_prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static const uint16_t timer2_prescale[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+struct sim_timer {
+    uint32_t phase; // Cycles into the current prescaler period
+};
+
+static struct sim_timer timer0, timer1, timer2;
+
+//  Counting rules shared by all three timers. The counter runs from 0 to
+//  top and wraps; match is raised when it reaches ocr, overflow when it
+//  wraps (except in CTC mode, where top is ocr and only match is raised).
+//  A counter written above top runs on to its maximum first.
+struct counter {
+    uint32_t count;
+    uint32_t top;
+    uint32_t max;
+    uint32_t ocr;
+    uint8_t ctc;
+};
+
+static uint32_t counter_wrap(const struct counter *c) {
+    return c->count > c->top ? c->max : c->top;
+}
+
+//  Counts until the next flag is raised
+static uint32_t counter_distance(const struct counter *c) {
+    uint32_t to_wrap = counter_wrap(c) - c->count + 1;
+    uint32_t to_match = UINT32_MAX;
+    if (c->ocr > c->count && c->ocr <= counter_wrap(c)) to_match = c->ocr - c->count;
+    else if (c->ocr <= c->top) to_match = to_wrap + c->ocr;
+    if (c->ctc || to_match < to_wrap) return to_match;
+    return to_wrap;
+}
+
+//  Advance by n counts, at most counter_distance(). Returns the flags raised:
+//  bit 0 overflow, bit 1 match.
+static uint8_t counter_advance(struct counter *c, uint32_t n) {
+    uint32_t wrap = counter_wrap(c);
+    uint8_t flags = 0;
+    if (!n) return 0;
+    c->count += n;
+    if (c->count > wrap) {
+        c->count -= wrap + 1;
+        if (!c->ctc) flags |= 1;
+    }
+    if (c->count == c->ocr) flags |= 2;
+    return flags;
+}
+
+static uint64_t timer_cycles(const struct sim_timer *t, uint16_t prescale, const struct counter *c) {
+    if (!prescale) return NEVER;
+    return (uint64_t) counter_distance(c) * prescale - t->phase;
+}
+
+static uint32_t timer_counts(struct sim_timer *t, uint16_t prescale, uint64_t cycles) {
+    if (!prescale) return 0;
+    uint64_t total = t->phase + cycles;
+    t->phase = total % prescale;
+    return total / prescale;
+}
+
+static void timer8_counter(struct counter *c, uint8_t tccra, uint8_t tccrb, uint8_t tcnt, uint8_t ocra) {
+    uint8_t wgm = (tccra & 0x03) | ((tccrb >> 1) & 0x04);
+    c->count = tcnt;
+    c->ocr = ocra;
+    c->ctc = wgm == 2;
+    c->top = (wgm == 2 || wgm == 7) ? ocra : 0xFF;
+    c->max = 0xFF;
+}
+
+static void timer1_counter(struct counter *c) {
+    c->count = TCNT1;
+    c->ocr = OCR1A;
+    c->ctc = 0;
+    c->top = 0xFFFF; // Normal mode only
+    c->max = 0xFFFF;
+}
+
+static uint64_t timers_next(void) {
+    struct counter c;
+    uint64_t next = NEVER, t;
+    timer8_counter(&c, TCCR0A, TCCR0B, TCNT0, OCR0A);
+    t = timer_cycles(&timer0, timer01_prescale[TCCR0B & 7], &c);
+    if (t < next) next = t;
+    timer1_counter(&c);
+    t = timer_cycles(&timer1, timer01_prescale[TCCR1B & 7], &c);
+    if (t < next) next = t;
+    timer8_counter(&c, TCCR2A, TCCR2B, TCNT2, OCR2A);
+    t = timer_cycles(&timer2, timer2_prescale[TCCR2B & 7], &c);
+    if (t < next) next = t;
+    return next;
+}
+
+static void timers_advance(uint64_t cycles) {
+    struct counter c;
+    uint8_t flags;
+
+    timer8_counter(&c, TCCR0A, TCCR0B, TCNT0, OCR0A);
+    flags = counter_advance(&c, timer_counts(&timer0, timer01_prescale[TCCR0B & 7], cycles));
+    TCNT0 = c.count;
+    if (flags & 2) TIFR0 |= (1 << OCF0A);
+
+    timer1_counter(&c);
+    flags = counter_advance(&c, timer_counts(&timer1, timer01_prescale[TCCR1B & 7], cycles));
+    TCNT1 = c.count;
+    if (flags & 1) TIFR1 |= (1 << TOV1);
+    if (flags & 2) TIFR1 |= (1 << OCF1A);
+
+    timer8_counter(&c, TCCR2A, TCCR2B, TCNT2, OCR2A);
+    flags = counter_advance(&c, timer_counts(&timer2, timer2_prescale[TCCR2B & 7], cycles));
+    TCNT2 = c.count;
+    if (flags & 1) TIFR2 |= (1 << TOV2);
+    if (flags & 2) TIFR2 |= (1 << OCF2A);
+}
+
+//  ******************************************
+//     ADC
+//  ******************************************
+//
+//  A conversion takes 13 ADC clocks. Starting one is noticed at the next
+//  step after ADSC is written, which is as soon as anything could tell.
+static uint16_t pot_value = 512;
+static uint64_t adc_done = NEVER;
+
+static uint64_t adc_next(void) {
+    if (adc_done == NEVER && (ADCSRA & (1 << ADEN)) && (ADCSRA & (1 << ADSC))) {
+        uint8_t prescale = 1 << (ADCSRA & 7);
+        if (prescale == 1) prescale = 2;
+        adc_done = now + 13UL * prescale;
+    }
+    return adc_done == NEVER ? NEVER : adc_done - now;
+}
+
+static void adc_advance(void) {
+    if (adc_done == NEVER || now < adc_done) return;
+    adc_done = NEVER;
+    ADC = pot_value;
+    ADCSRA |= (1 << ADIF);
+    // Free running (ADTS = 0) starts the next conversion straight away
+    if (!(ADCSRA & (1 << ADATE)) || (ADCSRB & 7)) ADCSRA &= ~(1 << ADSC);
+}
+
+//  ******************************************
+//     USART
+//  ******************************************
+//
+//  UDR0 and the shift register form a two-byte transmit buffer; UDRE0 clears
+//  while both are full. Received bytes arrive one frame apart.
+#define RX_QUEUE_SIZE 256
+
+static void (*uart_tx_hook)(uint8_t data);
+static uint64_t tx_shift_done = 0; // When the byte in the shift register is out
+static uint8_t tx_udr_full = 0;
+static uint8_t rx_queue[RX_QUEUE_SIZE];
+static uint16_t rx_head = 0, rx_tail = 0;
+static uint64_t rx_next = 0; // Earliest arrival of the next byte
+static uint8_t rx_full = 0;
+
+static uint64_t uart_frame(void) {
+    return 10ULL * ((UCSR0A & (1 << U2X0)) ? 8 : 16) * (UBRR0 + 1ULL);
+}
+
+//  Status bits are read-only on the chip, so a plain write to UCSR0A can't
+//  change them. Put them back before anyone looks.
+static void uart_status(void) {
+    uint8_t status = 0;
+    if (!tx_udr_full) status |= (1 << UDRE0);
+    if (rx_full) status |= (1 << RXC0);
+    UCSR0A = (UCSR0A & ~((1 << UDRE0) | (1 << RXC0))) | status;
+}
+
+static uint64_t uart_next(void) {
+    uint64_t next = NEVER;
+    if (tx_udr_full) next = tx_shift_done > now ? tx_shift_done - now : 0;
+    if (!rx_full && rx_head != rx_tail && (UCSR0B & (1 << RXEN0))) {
+        uint64_t rx = rx_next > now ? rx_next - now : 0;
+        if (rx < next) next = rx;
+    }
+    return next;
+}
+
+static void uart_advance(void) {
+    if (tx_udr_full && now >= tx_shift_done) {
+        tx_udr_full = 0;
+        tx_shift_done += uart_frame();
+    }
+    if (!rx_full && rx_head != rx_tail && (UCSR0B & (1 << RXEN0)) && now >= rx_next) {
+        UDR0 = rx_queue[rx_tail];
+        rx_tail = (rx_tail + 1) % RX_QUEUE_SIZE;
+        rx_full = 1;
+        rx_next = now + uart_frame();
+    }
+    uart_status();
+}
+
+void hal_host_uart_write(uint8_t data) {
+    UDR0 = data;
+    if (!(UCSR0B & (1 << TXEN0))) return;
+    if (uart_tx_hook) uart_tx_hook(data);
+    if (now >= tx_shift_done) tx_shift_done = now + uart_frame();
+    else tx_udr_full = 1;
+    uart_status();
+}
+
+uint8_t hal_host_uart_read(void) {
+    rx_full = 0;
+    uart_status();
+    return UDR0;
+}
+
+void hal_host_uart_feed(uint8_t data) {
+    uint16_t next = (rx_head + 1) % RX_QUEUE_SIZE;
+    if (next == rx_tail) return;
+    rx_queue[rx_head] = data;
+    rx_head = next;
+}
+
+void hal_host_on_uart_tx(void (*hook)(uint8_t data)) {
+    uart_tx_hook = hook;
+}
+
+//  ******************************************
+//     Interrupt dispatch
+//  ******************************************
+static void call_vector(void (*vector)(void), const char *name) {
+    if (!vector) {
+        // The chip would jump to __bad_interrupt and reset
+        fprintf(stderr, "hal_host: %s enabled but not defined\n", name);
+        exit(1);
+    }
+    isr_calls++;
+    SREG &= ~(1 << SREG_I);
+    hal_host_delay(ISR_CYCLES);
+    vector();
+    SREG |= (1 << SREG_I);
+}
+
+//  PINC is written directly (by the console or a host tool), so changes are
+//  picked up here, before every dispatch. Like the chip, only pins enabled
+//  in PCMSK1 raise the flag.
+static uint8_t pinc_seen = 0;
+
+static void pin_change_advance(void) {
+    if ((PINC ^ pinc_seen) & PCMSK1) PCIFR |= (1 << PCIF1);
+    pinc_seen = PINC;
+}
+
+//  Run the highest priority pending interrupt. Returns 0 if there was none.
+static uint8_t dispatch_one(void) {
+    if ((PCIFR & (1 << PCIF1)) && (PCICR & (1 << PCIE1))) {
+        PCIFR &= ~(1 << PCIF1);
+        call_vector(PCINT1_vect, "PCINT1_vect");
+    }
+    else if ((TIFR2 & (1 << OCF2A)) && (TIMSK2 & (1 << OCIE2A))) {
+        TIFR2 &= ~(1 << OCF2A);
+        call_vector(TIMER2_COMPA_vect, "TIMER2_COMPA_vect");
+    }
+    else if ((TIFR2 & (1 << TOV2)) && (TIMSK2 & (1 << TOIE2))) {
+        TIFR2 &= ~(1 << TOV2);
+        call_vector(TIMER2_OVF_vect, "TIMER2_OVF_vect");
+    }
+    else if ((TIFR1 & (1 << OCF1A)) && (TIMSK1 & (1 << OCIE1A))) {
+        TIFR1 &= ~(1 << OCF1A);
+        call_vector(TIMER1_COMPA_vect, "TIMER1_COMPA_vect");
+    }
+    else if ((TIFR1 & (1 << TOV1)) && (TIMSK1 & (1 << TOIE1))) {
+        TIFR1 &= ~(1 << TOV1);
+        call_vector(TIMER1_OVF_vect, "TIMER1_OVF_vect");
+    }
+    else if ((TIFR0 & (1 << OCF0A)) && (TIMSK0 & (1 << OCIE0A))) {
+        TIFR0 &= ~(1 << OCF0A);
+        call_vector(TIMER0_COMPA_vect, "TIMER0_COMPA_vect");
+    }
+    else if (rx_full && (UCSR0B & (1 << RXCIE0))) {
+        call_vector(USART_RX_vect, "USART_RX_vect"); // Reading UDR0 clears it
+    }
+    else if (!tx_udr_full && (UCSR0B & (1 << UDRIE0))) {
+        call_vector(USART_UDRE_vect, "USART_UDRE_vect"); // Level triggered
+    }
+    else if ((ADCSRA & (1 << ADIF)) && (ADCSRA & (1 << ADIE))) {
+        ADCSRA &= ~(1 << ADIF);
+        call_vector(ADC_vect, "ADC_vect");
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+static void dispatch(void) {
+    pin_change_advance();
+    while ((SREG & (1 << SREG_I)) && dispatch_one()) {}
+}
+
+void hal_host_sei(void) {
+    SREG |= (1 << SREG_I);
+    dispatch();
+}
+
+void hal_host_restore(const uint8_t *sreg) {
+    SREG = *sreg;
+    if (SREG & (1 << SREG_I)) hal_host_run(ATOMIC_CYCLES);
+}
+
+//  ******************************************
+//     Console
+//  ******************************************
+//
+//  When enabled, UART output goes to stdout and stdin is read as it comes.
+//  Keys that aren't buttons go to the UART receiver (line endings dropped):
+//      space   press SELECT (jump) for 150 ms
+//      < or ,  press LEFT (quit)
+//      > or .  press RIGHT (one more round)
+//      [ and ] turn the pot down and up
+//  With a terminal on stdin the simulation is paced to real time so the game
+//  can be played; otherwise it runs flat out. MICRODINO_SECONDS=<n> ends the
+//  run after n seconds of virtual time.
+#define CONSOLE_POLL (F_CPU / 1000) // Once per virtual millisecond
+#define BUTTON_PRESS (F_CPU / 1000 * 150)
+
+static uint8_t console = 1;
+static uint8_t realtime = 0;
+static uint64_t console_next = 0;
+static uint64_t time_limit = NEVER;
+static uint64_t button_release[3] = {NEVER, NEVER, NEVER};
+static struct timespec wall_start;
+static struct termios saved_termios;
+
+static void console_tx(uint8_t data) {
+    putchar(data);
+    if (realtime) fflush(stdout);
+}
+
+static void console_press(uint8_t button) {
+    PINC |= (1 << button);
+    button_release[button] = now + BUTTON_PRESS;
+}
+
+static void console_key(uint8_t key) {
+    switch (key) {
+        case ' ': console_press(1); break;
+        case '<': case ',': console_press(2); break;
+        case '>': case '.': console_press(0); break;
+        case '[': pot_value = pot_value >= 128 ? pot_value - 128 : 0; break;
+        case ']': pot_value = pot_value <= 1023 - 128 ? pot_value + 128 : 1023; break;
+        case '\r': case '\n': break;
+        default: hal_host_uart_feed(key); break;
+    }
+}
+
+static void console_pace(void) {
+    struct timespec wall;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    int64_t wall_us = (wall.tv_sec - wall_start.tv_sec) * 1000000LL + (wall.tv_nsec - wall_start.tv_nsec) / 1000;
+    int64_t ahead_us = (int64_t) (now / (F_CPU / 1000000)) - wall_us;
+    if (ahead_us > 1000) usleep(ahead_us);
+}
+
+static void console_poll(void) {
+    for (uint8_t button = 0; button < 3; button++) {
+        if (now >= button_release[button]) {
+            PINC &= ~(1 << button);
+            button_release[button] = NEVER;
+        }
+    }
+    if (now >= time_limit) exit(0);
+
+    fd_set fds;
+    struct timeval none = {0, 0};
+    FD_ZERO(&fds);
+    FD_SET(0, &fds);
+    while (select(1, &fds, 0, 0, &none) > 0) {
+        uint8_t key;
+        if (read(0, &key, 1) != 1) {
+            FD_CLR(0, &fds);
+            break;
+        }
+        console_key(key);
+    }
+    if (realtime) console_pace();
+}
+
+static void console_restore(void) {
+    fflush(stdout);
+    if (realtime) tcsetattr(0, TCSANOW, &saved_termios);
+}
+
+__attribute__((constructor)) static void console_setup(void) {
+    const char *seconds = getenv("MICRODINO_SECONDS");
+    if (seconds) time_limit = strtoull(seconds, 0, 10) * F_CPU;
+    uart_tx_hook = console_tx;
+    if (isatty(0)) {
+        // Keys take effect without Enter and aren't echoed
+        struct termios raw;
+        tcgetattr(0, &saved_termios);
+        raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(0, TCSANOW, &raw);
+        realtime = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    atexit(console_restore);
+}
+
+void hal_host_console(uint8_t enable) {
+    console = enable;
+    if (!enable && uart_tx_hook == console_tx) uart_tx_hook = 0;
+}
+
+//  ******************************************
+//     Virtual time
+//  ******************************************
+//  Advance to the next event or to target, whichever comes first
+static void run_step(uint64_t target) {
+    uint64_t step = target - now, next;
+    if ((next = timers_next()) < step) step = next;
+    if ((next = adc_next()) < step) step = next;
+    if ((next = uart_next()) < step) step = next;
+    if (console && (next = console_next > now ? console_next - now : 0) < step) step = next;
+
+    timers_advance(step);
+    now += step;
+    adc_advance();
+    uart_advance();
+    if (console && now >= console_next) {
+        console_next = now + CONSOLE_POLL;
+        console_poll();
+    }
+    dispatch();
+}
+
+void hal_host_run(uint64_t cycles) {
+    uint64_t target = now + cycles;
+    while (now < target) run_step(target);
+}
+
+//  Sleep until an interrupt has been serviced. Like the chip, with
+//  interrupts off this never returns.
+void hal_host_sleep(void) {
+    uint64_t start = now;
+    uint32_t calls = isr_calls;
+    if (!(SMCR & 1)) return; // SE clear: sleep is a no-op
+    while (isr_calls == calls) run_step(NEVER);
+    sleep_cycles += now - start;
+}
+
+uint64_t hal_host_sleep_cycles(void) {
+    return sleep_cycles;
+}
+
+uint64_t hal_host_cycles(void) {
+    return now;
+}
+
+void hal_host_delay(uint64_t cycles) {
+    hal_host_run(cycles);
+}
+
+void hal_host_spin(void) {
+    hal_host_run(SPIN_CYCLES);
+}
+
+//  The LCD and similar parts latch on the falling edge, which is when the
+//  hook sees the port.
+static void (*strobe_hook)(volatile uint8_t *port, uint8_t bit);
+
+void hal_host_on_strobe(void (*hook)(volatile uint8_t *port, uint8_t bit)) {
+    strobe_hook = hook;
+}
+
+void hal_host_strobe(volatile uint8_t *port, uint8_t bit) {
+    *port |= (1 << bit);
+    hal_host_run(F_CPU / 1000000);
+    if (strobe_hook) strobe_hook(port, bit);
+    *port &= ~(1 << bit);
+}
+
+void hal_host_set_pot(uint16_t value) {
+    pot_value = value & 0x3FF;
+}
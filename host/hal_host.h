@@ -0,0 +1,231 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+//  ******************************************
+//     Host backend for hal.h
+//  ******************************************
+//
+//  Builds main.c as a native program. The ATmega328P registers are plain
+//  variables, and hal_host.c simulates Timer0/1/2, the ADC, the USART and
+//  port C's pin change interrupt against a virtual clock of F_CPU cycles,
+//  raising the same flags and calling the same ISRs the chip would. Virtual
+//  time only moves when the firmware waits (delays, strobes, hal_spin(),
+//  sleep_cpu()) or leaves an atomic block, so runs are deterministic and go
+//  as fast as the host allows.
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+//  ******************************************
+//     Registers
+//  ******************************************
+extern volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B;
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+extern volatile uint8_t ADCSRA, ADCSRB, ADMUX, DIDR0;
+extern volatile uint16_t ADC;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+extern volatile uint16_t UBRR0;
+extern volatile uint8_t SREG;
+extern volatile uint8_t SMCR;
+extern volatile uint8_t PCICR, PCMSK1, PCIFR;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#define WGM00 0
+#define WGM01 1
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define OCIE0A 1
+#define OCF0A 1
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define REFS0 6
+#define REFS1 7
+#define ADC5D 5
+
+#define U2X0 1
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define RXCIE0 7
+#define UCSZ00 1
+#define UCSZ01 2
+
+#define PCIE1 1
+#define PCINT9 1
+#define PCIF1 1
+
+#define SREG_I 7
+
+//  ******************************************
+//     Interrupts
+//  ******************************************
+//
+//  An ISR is an ordinary function; hal_host.c calls it when its flag and
+//  enable bit are set and interrupts are on.
+#define ISR(vector) void vector(void)
+
+void hal_host_sei(void);
+void hal_host_restore(const uint8_t *sreg);
+
+#define sei() hal_host_sei()
+#define cli() (SREG &= ~(1 << SREG_I))
+
+//  Same shape as util/atomic.h: the cleanup handler restores SREG however
+//  the block is left, including return.
+#define ATOMIC_RESTORESTATE \
+    uint8_t sreg_save __attribute__((__cleanup__(hal_host_restore))) = SREG
+#define ATOMIC_BLOCK(type) \
+    for (type, atomic_todo = (cli(), 1); atomic_todo; atomic_todo = 0)
+
+//  ******************************************
+//     Sleep
+//  ******************************************
+void hal_host_sleep(void);
+
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~0x0E) | (mode))
+#define sleep_enable() (SMCR |= 1)
+#define sleep_disable() (SMCR &= ~1)
+#define sleep_cpu() hal_host_sleep()
+
+//  ******************************************
+//     Program memory
+//  ******************************************
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+//  Flash is ordinary memory here. Words are copied out, since the firmware
+//  reads int fields through them.
+static inline uint16_t hal_host_read_word(const void *addr) {
+    uint16_t value;
+    memcpy(&value, addr, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hal_host_read_dword(const void *addr) {
+    uint32_t value;
+    memcpy(&value, addr, sizeof(value));
+    return value;
+}
+
+static inline void *hal_host_read_ptr(const void *addr) {
+    void *value;
+    memcpy(&value, addr, sizeof(value));
+    return value;
+}
+
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) hal_host_read_word(addr)
+#define pgm_read_dword(addr) hal_host_read_dword(addr)
+#define pgm_read_ptr(addr) hal_host_read_ptr(addr)
+
+//  ******************************************
+//     HAL operations
+//  ******************************************
+void hal_host_delay(uint64_t cycles);
+void hal_host_strobe(volatile uint8_t *port, uint8_t bit);
+void hal_host_uart_write(uint8_t data);
+uint8_t hal_host_uart_read(void);
+void hal_host_spin(void);
+
+#define hal_delay_ms(ms) hal_host_delay((uint64_t) ((ms) * (F_CPU / 1000.0)))
+#define hal_delay_us(us) hal_host_delay((uint64_t) ((us) * (F_CPU / 1000000.0)))
+#define hal_gpio_strobe(port, bit) hal_host_strobe(&(port), (bit))
+#define hal_clear_flag(reg, bit) ((reg) &= ~(1 << (bit)))
+#define hal_timer2_count() TCNT2
+#define hal_adc_read() ADC
+#define hal_uart_write(data) hal_host_uart_write(data)
+#define hal_uart_read() hal_host_uart_read()
+#define hal_spin() hal_host_spin()
+
+//  ******************************************
+//     Simulation interface
+//  ******************************************
+//
+//  For host tools driving the firmware. By default the simulator acts as a
+//  console: UART output goes to stdout and stdin feeds the UART and the
+//  buttons (see hal_host.c). hal_host_console(0) turns that off.
+uint64_t hal_host_cycles(void); // Virtual time since reset
+uint64_t hal_host_sleep_cycles(void); // Of which spent asleep
+void hal_host_run(uint64_t cycles); // Let virtual time pass, servicing interrupts
+void hal_host_console(uint8_t enable);
+void hal_host_set_pot(uint16_t value); // 10-bit reading on the ADC
+void hal_host_uart_feed(uint8_t data); // Queue a byte on the UART receiver
+void hal_host_on_uart_tx(void (*hook)(uint8_t data));
+void hal_host_on_strobe(void (*hook)(volatile uint8_t *port, uint8_t bit));
+
+#endif
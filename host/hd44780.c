@@ -0,0 +1,129 @@
+#include "hd44780.h"
+
+#include <string.h>
+
+//  Execution times in microseconds, from the datasheet at 270 kHz
+#define T_CLEAR_HOME 1520
+#define T_EXEC 37
+#define T_DATA 41 // 37 plus 4 for the address counter update
+
+void hd44780_init(struct hd44780 *lcd, uint32_t cycles_per_us) {
+    memset(lcd, 0, sizeof(*lcd));
+    memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+    lcd->increment = 1;
+    lcd->cycles_per_us = cycles_per_us;
+}
+
+static uint8_t *ddram_cell(struct hd44780 *lcd, uint8_t addr) {
+    return &lcd->ddram[(addr >> 6) & 1][(addr & 0x3F) % HD44780_LINE];
+}
+
+//  Step the DDRAM address counter: each line is 40 cells, and running off
+//  the end of one continues on the other.
+static uint8_t ddram_next(uint8_t addr, uint8_t increment) {
+    uint8_t line = addr & 0x40;
+    uint8_t col = (addr & 0x3F) % HD44780_LINE;
+    if (increment) {
+        if (++col == HD44780_LINE) return line ^ 0x40;
+    }
+    else {
+        if (col-- == 0) return (line ^ 0x40) | (HD44780_LINE - 1);
+    }
+    return line | col;
+}
+
+static void display_shift(struct hd44780 *lcd, uint8_t left) {
+    if (left) lcd->shift = (lcd->shift + 1) % HD44780_LINE;
+    else lcd->shift = (lcd->shift + HD44780_LINE - 1) % HD44780_LINE;
+}
+
+//  Returns the execution time in microseconds
+static uint16_t instruction(struct hd44780 *lcd, uint8_t cmd) {
+    if (cmd & 0x80) {
+        lcd->addr = cmd & 0x7F;
+        lcd->cgram_selected = 0;
+    }
+    else if (cmd & 0x40) {
+        lcd->addr = cmd & 0x3F;
+        lcd->cgram_selected = 1;
+    }
+    else if (cmd & 0x20) {
+        lcd->four_bit = !(cmd & 0x10);
+    }
+    else if (cmd & 0x10) {
+        if (cmd & 0x08) display_shift(lcd, !(cmd & 0x04));
+        else lcd->addr = ddram_next(lcd->addr, cmd & 0x04);
+    }
+    else if (cmd & 0x08) {
+        lcd->display_on = (cmd & 0x04) != 0;
+    }
+    else if (cmd & 0x04) {
+        lcd->increment = (cmd & 0x02) != 0;
+        lcd->entry_shift = cmd & 0x01;
+    }
+    else if (cmd & 0x02) {
+        lcd->addr = 0;
+        lcd->cgram_selected = 0;
+        lcd->shift = 0;
+        return T_CLEAR_HOME;
+    }
+    else if (cmd & 0x01) {
+        memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+        lcd->addr = 0;
+        lcd->cgram_selected = 0;
+        lcd->shift = 0;
+        lcd->increment = 1;
+        return T_CLEAR_HOME;
+    }
+    else {
+        return 0; // Not an instruction
+    }
+    return T_EXEC;
+}
+
+static uint16_t data_write(struct hd44780 *lcd, uint8_t data) {
+    if (lcd->cgram_selected) {
+        lcd->cgram[lcd->addr & 0x3F] = data & 0x1F;
+        lcd->addr = (lcd->addr + (lcd->increment ? 1 : -1)) & 0x3F;
+    }
+    else {
+        *ddram_cell(lcd, lcd->addr) = data;
+        lcd->addr = ddram_next(lcd->addr, lcd->increment);
+        if (lcd->entry_shift) display_shift(lcd, lcd->increment);
+    }
+    return T_DATA;
+}
+
+static void execute(struct hd44780 *lcd, uint8_t rs, uint8_t byte, uint64_t now) {
+    uint16_t us = rs ? data_write(lcd, byte) : instruction(lcd, byte);
+    if (!us) return;
+    if (rs) lcd->writes++;
+    else lcd->commands++;
+    lcd->transactions++;
+    lcd->settle_us += us;
+    lcd->busy_until = now + (uint64_t) us * lcd->cycles_per_us;
+}
+
+void hd44780_edge(struct hd44780 *lcd, uint8_t rs, uint8_t nibble, uint64_t now) {
+    nibble &= 0x0F;
+    if (now < lcd->busy_until) {
+        lcd->violations++;
+        return;
+    }
+    if (!lcd->four_bit) {
+        execute(lcd, rs, nibble << 4, now);
+        lcd->have_upper = 0;
+        return;
+    }
+    if (!lcd->have_upper) {
+        lcd->upper = nibble;
+        lcd->have_upper = 1;
+        return;
+    }
+    lcd->have_upper = 0;
+    execute(lcd, rs, (lcd->upper << 4) | nibble, now);
+}
+
+uint8_t hd44780_cell(const struct hd44780 *lcd, uint8_t row, uint8_t col) {
+    return lcd->ddram[row & 1][(col + lcd->shift) % HD44780_LINE];
+}
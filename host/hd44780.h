@@ -0,0 +1,53 @@
+#ifndef HD44780_H
+#define HD44780_H
+
+//  ******************************************
+//     Simulated HD44780 character LCD
+//  ******************************************
+//
+//  Fed one EN falling edge at a time with the RS line and the D7-D4 nibble,
+//  exactly what the 4-bit wiring on the board carries. The controller comes
+//  up in 8-bit mode, so until a function set selects 4 bits each edge is a
+//  whole instruction with the low nibble read as zero.
+//
+//  Every executed instruction counts as one bus transaction and keeps the
+//  controller busy for its datasheet execution time (at 270 kHz). An edge
+//  that arrives while the controller is still busy is counted as a violation
+//  and ignored, as the real part would ignore it.
+
+#include <stdint.h>
+
+#define HD44780_LINE 40 // DDRAM cells per line
+
+struct hd44780 {
+    uint8_t ddram[2][HD44780_LINE];
+    uint8_t cgram[64];
+    uint8_t addr; // Address counter
+    uint8_t cgram_selected; // Data goes to CGRAM rather than DDRAM
+    uint8_t four_bit;
+    uint8_t have_upper; // 4-bit mode: upper nibble received
+    uint8_t upper;
+    uint8_t increment; // Entry mode I/D
+    uint8_t entry_shift; // Entry mode S
+    uint8_t display_on;
+    uint8_t shift; // DDRAM column shown at the left edge
+    uint32_t cycles_per_us;
+    uint64_t busy_until;
+
+    // Statistics
+    unsigned long transactions;
+    unsigned long commands;
+    unsigned long writes;
+    unsigned long violations;
+    uint64_t settle_us; // Sum of the mandatory execution times
+};
+
+void hd44780_init(struct hd44780 *lcd, uint32_t cycles_per_us);
+
+//  One EN falling edge at time now (in cycles)
+void hd44780_edge(struct hd44780 *lcd, uint8_t rs, uint8_t nibble, uint64_t now);
+
+//  The character code shown at a position of the 16x2 window
+uint8_t hd44780_cell(const struct hd44780 *lcd, uint8_t row, uint8_t col);
+
+#endif
@@ -0,0 +1,225 @@
+//  ******************************************
+//     LCD bus benchmark
+//  ******************************************
+//
+//  Runs the game's frame function against the simulated HD44780 at every
+//  speed level and reports what each frame costs on the LCD bus:
+//      tx/frame      instructions executed by the controller
+//      settle us     their mandatory execution times added up
+//      bus us        first strobe to the controller going idle, i.e. the
+//                    settle times plus the firmware's own pacing overhead
+//
+//  Each frame is one game_step() and game_render() a scroll period after
+//  the last, so every frame scrolls. An autopilot holds SELECT while an
+//  obstacle is close, so the run isn't cut short. The random sequence is
+//  fixed, so runs are repeatable.
+//
+//  The results are compared with a baseline file and the bench exits with 1
+//  if any figure is more than BENCH_TOLERANCE worse. --update rewrites the
+//  baseline instead. The bench also exits with 2 if the simulated display
+//  ever disagrees with the firmware's idea of it, or if the firmware
+//  strobed the controller while it was busy.
+//
+//      cc -std=gnu99 -O2 -o lcd-bench host/lcd_bench.c game.c host/hal_host.c host/hd44780.c
+//      ./lcd-bench [--update] [baseline]
+
+#define MICRODINO_NO_MAIN
+#include "../main.c"
+
+#include <stdio.h>
+#include <string.h>
+#include "hd44780.h"
+
+#define BENCH_FRAMES 2000 // Per speed level
+#define BENCH_SEED 1
+#define BENCH_TOLERANCE 0.01 // Allowed regression, as a fraction
+#define BENCH_BASELINE "host/lcd_bench.baseline"
+
+#define NO_EDGE UINT64_MAX
+
+struct hd44780 lcd;
+uint64_t frame_first_edge = NO_EDGE;
+
+struct bench_result {
+    double tx;
+    double settle_us;
+    double bus_us;
+};
+
+void bench_strobe(volatile uint8_t *port, uint8_t bit) {
+    if (port != &PORTB || bit != EN) return;
+    uint64_t now = hal_host_cycles();
+    if (frame_first_edge == NO_EDGE) frame_first_edge = now;
+    hd44780_edge(&lcd, (PORTD >> RS) & 1, PORTD >> 4, now);
+}
+
+//  A user-defined character on screen shows the glyph the cache put in its
+//  slot, all of it
+uint8_t bench_glyph_matches(uint8_t code) {
+    if (code >= LCD_GLYPH_SLOTS) return 1;
+    if (!lcd_glyph_bmp[code] || lcd_glyph_rows[code] != LCD_GLYPH_HEIGHT) return 0;
+    for (uint8_t row = 0; row < LCD_GLYPH_HEIGHT; row++) {
+        if (lcd.cgram[code * LCD_GLYPH_HEIGHT + row] != pgm_read_byte(&lcd_glyph_bmp[code][row])) return 0;
+    }
+    return 1;
+}
+
+//  Compare the simulated controller with the firmware's shadow of it, and
+//  what is on screen with the frame the firmware meant to show
+uint8_t bench_display_matches(void) {
+    if (lcd.shift != lcd_shift) return 0;
+    for (uint8_t row = 0; row < LCD_ROWS; row++) {
+        for (uint8_t col = 0; col < LCD_LINE; col++) {
+            if (lcd.ddram[row][col] != lcd_ddram[row][col]) return 0;
+        }
+        for (uint8_t col = 0; col < LCD_COLS; col++) {
+            if (hd44780_cell(&lcd, row, col) != lcd_fb[row][col]) return 0;
+            if (!bench_glyph_matches(lcd_fb[row][col])) return 0;
+        }
+    }
+    return 1;
+}
+
+void bench_reset_game(uint8_t level, unsigned long now) {
+    select_held = 0;
+    DirectLCD_clear();
+    apply_speed(level);
+    world_seed(&game, BENCH_SEED);
+    round_start(now);
+    game_render();
+    DirectLCD_fence();
+}
+
+int bench_level(uint8_t level, struct bench_result *result) {
+    unsigned long tx = 0, deaths = 0;
+    uint64_t settle_us = 0, bus_cycles = 0;
+    unsigned long now = 0;
+
+    bench_reset_game(level, now);
+    for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+        unsigned long tx_start = lcd.transactions;
+        uint64_t settle_start = lcd.settle_us;
+        frame_first_edge = NO_EDGE;
+
+        now += game.scroll_speed;
+        select_held = 0;
+        for (uint8_t col = RUNNER_COL; col <= RUNNER_COL + 2; col++) {
+            if (is_obstacle(world_cell(&game, col))) select_held = 1;
+        }
+        uint8_t result = game_step(&game, now, select_held);
+        if (result & GAME_OVER) {
+            deaths++;
+            bench_reset_game(level, now);
+            continue;
+        }
+        if (result & GAME_MOVED) frame_dirty = 1;
+        game_render();
+        DirectLCD_fence();
+
+        tx += lcd.transactions - tx_start;
+        settle_us += lcd.settle_us - settle_start;
+        if (frame_first_edge != NO_EDGE) bus_cycles += lcd.busy_until - frame_first_edge;
+        if (!bench_display_matches()) {
+            fprintf(stderr, "level %u frame %d: display does not match the firmware's shadow\n", level, frame);
+            return 0;
+        }
+    }
+    if (lcd.violations) {
+        fprintf(stderr, "level %u: %lu strobes while the controller was busy\n", level, lcd.violations);
+        return 0;
+    }
+    if (deaths) fprintf(stderr, "level %u: autopilot died %lu times\n", level, deaths);
+
+    result->tx = (double) tx / BENCH_FRAMES;
+    result->settle_us = (double) settle_us / BENCH_FRAMES;
+    result->bus_us = (double) bus_cycles / (F_CPU / 1000000) / BENCH_FRAMES;
+    return 1;
+}
+
+int bench_read_baseline(const char *path, struct bench_result *baseline) {
+    FILE *file = fopen(path, "r");
+    char line[128];
+    int levels = 0;
+    if (!file) return 0;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned level;
+        struct bench_result r;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%u %lf %lf %lf", &level, &r.tx, &r.settle_us, &r.bus_us) == 4 && level < SPEED_LEVELS) {
+            baseline[level] = r;
+            levels++;
+        }
+    }
+    fclose(file);
+    return levels == SPEED_LEVELS;
+}
+
+int bench_write_baseline(const char *path, const struct bench_result *results) {
+    FILE *file = fopen(path, "w");
+    if (!file) return 0;
+    fprintf(file, "# level tx/frame settle_us/frame bus_us/frame\n");
+    for (uint8_t level = 0; level < SPEED_LEVELS; level++) {
+        fprintf(file, "%u %.2f %.2f %.2f\n", level, results[level].tx, results[level].settle_us, results[level].bus_us);
+    }
+    fclose(file);
+    return 1;
+}
+
+int bench_regressed(const char *what, uint8_t level, double value, double base) {
+    if (value <= base * (1 + BENCH_TOLERANCE) + 0.005) return 0;
+    printf("REGRESSION level %u %s: %.2f, baseline %.2f\n", level, what, value, base);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const char *baseline_path = BENCH_BASELINE;
+    int update = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--update")) update = 1;
+        else baseline_path = argv[i];
+    }
+
+    hal_host_console(0);
+    hd44780_init(&lcd, F_CPU / 1000000);
+    hal_host_on_strobe(bench_strobe);
+
+    game_init(&game);
+    uart_init();
+    device_setup();
+    matrix_setup();
+    DirectLCD_init();
+
+    struct bench_result results[SPEED_LEVELS];
+    printf("%-10s %10s %12s %12s\n", "level", "tx/frame", "settle us", "bus us");
+    for (uint8_t level = 0; level < SPEED_LEVELS; level++) {
+        if (!bench_level(level, &results[level])) return 2;
+        char label[16];
+        strncpy(label, (PGM_P) pgm_read_ptr(&speed_labels[level]), sizeof(label) - 1);
+        label[sizeof(label) - 1] = 0;
+        printf("%-10.10s %10.2f %12.2f %12.2f\n", label, results[level].tx, results[level].settle_us, results[level].bus_us);
+    }
+
+    if (update) {
+        if (!bench_write_baseline(baseline_path, results)) {
+            fprintf(stderr, "cannot write %s\n", baseline_path);
+            return 2;
+        }
+        printf("baseline written to %s\n", baseline_path);
+        return 0;
+    }
+
+    struct bench_result baseline[SPEED_LEVELS];
+    if (!bench_read_baseline(baseline_path, baseline)) {
+        fprintf(stderr, "no baseline in %s, run with --update to create one\n", baseline_path);
+        return 2;
+    }
+    int regressions = 0;
+    for (uint8_t level = 0; level < SPEED_LEVELS; level++) {
+        regressions += bench_regressed("tx/frame", level, results[level].tx, baseline[level].tx);
+        regressions += bench_regressed("settle us", level, results[level].settle_us, baseline[level].settle_us);
+        regressions += bench_regressed("bus us", level, results[level].bus_us, baseline[level].bus_us);
+    }
+    if (regressions) return 1;
+    printf("no regressions against %s\n", baseline_path);
+    return 0;
+}
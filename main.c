@@ -1,67 +1,443 @@
 #include <stdint.h>
-#include <stdio.h>
-#include <avr/io.h> 
-#include <avr/interrupt.h>
-#include <stdlib.h>
 #include <stdarg.h>
-#include <util/delay.h>
+#include "hal.h"
+#include "game.h"
+
+#define EVER ;;
+
+//  ******************************************
+//     ISR profiler
+//  ******************************************
+//
+//  Build with -DISR_PROFILE to time every interrupt handler against Timer1,
+//  which then free-runs at F_CPU/8 (0.5 us per count at 16 MHz). Each ISR
+//  keeps its call count, min/avg/max and a histogram of durations in powers
+//  of two: bucket 0 is under 2 us, bucket n is 2^n to 2^(n+1) us, and the
+//  last bucket takes everything longer. Send '?' over serial during a game
+//  for a report; '!' clears the statistics.
+//  Without the flag the macros are empty and nothing is compiled in.
+#ifdef ISR_PROFILE
+#define ISR_PROFILE_BUCKETS 8
+#define ISR_PROFILE_COUNTS_PER_US (F_CPU / 8 / 1000000UL)
+#define ISR_PROFILE_TIMER2_PERIOD (F_CPU / 8 / 1000) // Timer1 counts per tick, 1 ms
+#define ISR_PROFILE_TIMER2_SCALE (64 / 8) // Timer1 counts per Timer2 count
+
+#define ISR_ID_PCINT1 0
+#define ISR_ID_TIMER0_COMPA 1
+#define ISR_ID_TIMER2_OVF 2
+#define ISR_ID_USART_RX 3
+#define ISR_ID_USART_UDRE 4
+#define ISR_PROFILE_COUNT 5
+
+struct isr_stats {
+    uint32_t calls;
+    uint32_t total; // Timer1 counts
+    uint16_t min;
+    uint16_t max;
+    uint16_t histogram[ISR_PROFILE_BUCKETS];
+};
+
+struct isr_stats isr_stats[ISR_PROFILE_COUNT];
+uint8_t isr_depth = 0;
+uint16_t isr_nested = 0; // ISRs entered while another was running
+uint16_t isr_timer2_lost = 0; // Timer2 overflows that never got an interrupt
+uint16_t isr_timer1_wraps = 0; // Upper half of the extended Timer1 count
+uint32_t isr_timer2_last = 0; // When the last serviced overflow happened
+uint8_t isr_timer2_seen = 0;
+unsigned long isr_profile_start_ms = 0;
+
+void isr_profile_enter(void) {
+    if (isr_depth++) isr_nested++;
+}
+
+void isr_profile_exit(uint8_t id, uint16_t start) {
+    uint16_t counts = TCNT1 - start;
+    struct isr_stats *stats = &isr_stats[id];
+    isr_depth--;
+    if (!stats->calls || counts < stats->min) stats->min = counts;
+    if (counts > stats->max) stats->max = counts;
+    stats->calls++;
+    stats->total += counts;
+
+    uint8_t bucket = 0;
+    uint16_t us = counts / ISR_PROFILE_COUNTS_PER_US;
+    while ((us >>= 1) && bucket < ISR_PROFILE_BUCKETS - 1) bucket++;
+    if (stats->histogram[bucket] != 0xFFFF) stats->histogram[bucket]++;
+}
+
+//  Timer1 extended to 32 bits with its overflow flag. Timer2's ISR calls
+//  this every tick, so it sees every wrap unless interrupts stay off for
+//  more than two of them (65 ms).
+uint32_t isr_profile_timer1(void) {
+    uint16_t now = TCNT1;
+    if (TIFR1 & (1 << TOV1)) {
+        now = TCNT1; // The wrap came before this reading
+        hal_clear_flag(TIFR1, TOV1);
+        isr_timer1_wraps++;
+    }
+    return ((uint32_t) isr_timer1_wraps << 16) | now;
+}
+
+//  Count the Timer2 overflows that never got an interrupt, each a lost
+//  millisecond. The overflow this ISR serves happened TCNT2 counts ago,
+//  however late the ISR came. Serviced overflows are a whole number of
+//  ticks apart, and every tick beyond the first between two of them was an
+//  overflow the pending flag swallowed.
+void isr_profile_timer2(void) {
+    uint32_t now = isr_profile_timer1();
+    uint32_t overflow = now - (uint32_t) TCNT2 * ISR_PROFILE_TIMER2_SCALE;
+    // Late enough that the next overflow is pending already: TCNT2 counts
+    // from that one
+    if (TIFR2 & (1 << TOV2)) overflow -= ISR_PROFILE_TIMER2_PERIOD;
+    if (isr_timer2_seen) {
+        uint32_t ticks = (overflow - isr_timer2_last + ISR_PROFILE_TIMER2_PERIOD / 2) / ISR_PROFILE_TIMER2_PERIOD;
+        if (ticks > 1) isr_timer2_lost += ticks - 1;
+    }
+    isr_timer2_last = overflow;
+    isr_timer2_seen = 1;
+}
+
+#define ISR_PROFILE_ENTER() uint16_t isr_start = TCNT1; isr_profile_enter()
+#define ISR_PROFILE_EXIT(id) isr_profile_exit(id, isr_start)
+#define ISR_PROFILE_TIMER2() isr_profile_timer2()
+#else
+#define ISR_PROFILE_ENTER()
+#define ISR_PROFILE_EXIT(id)
+#define ISR_PROFILE_TIMER2()
+#endif
 
 // Writing directly to the LCD without using the LiquidCrystal Library
 #define RS PD2
 #define EN PB0
 
-void DirectLCD_command(uint8_t cmd)
+// Boards that wire the LCD's RW line to a spare PORTB pin can build with
+// -DLCD_BUSY_FLAG -DRW=<pin> to poll the busy flag instead of waiting out
+// the worst-case settle time of every transfer. PB0 is EN and PB1-PB5 are
+// the matrix columns, which leaves PB6/PB7: the crystal on an Uno, but PB7
+// is free on a board clocked from an external oscillator on XTAL1.
+#if defined(LCD_BUSY_FLAG) && !defined(RW)
+#error "LCD_BUSY_FLAG needs RW defined as the PORTB pin wired to the LCD's RW line"
+#endif
+#if defined(LCD_BUSY_FLAG) && (RW) == EN
+#error "RW can't share PB0 with the LCD's EN line"
+#endif
+
+// Settle time per instruction class in microseconds (HD44780 datasheet
+// values at 270 kHz plus some margin). Only clear/home need milliseconds.
+#define LCD_T_CLEAR_HOME 0 // 0x01 clear, 0x02 home: 1.52 ms
+#define LCD_T_EXEC 1 // entry mode, display control, shift, function set: 37 us
+#define LCD_T_ADDR 2 // CGRAM/DDRAM address set: 37 us
+#define LCD_T_DATA 3 // data write: 37 us + 4 us address counter update
+
+const uint16_t lcd_settle_us[4] PROGMEM = {1600, 40, 40, 45};
+
+uint8_t DirectLCD_command_class(uint8_t cmd)
+{
+	if (cmd & 0xC0) return LCD_T_ADDR; // 0x80 DDRAM or 0x40 CGRAM address
+	if (cmd & 0xFC) return LCD_T_EXEC; // 0x20 function set, 0x10 shift, 0x08 display, 0x04 entry mode
+	return LCD_T_CLEAR_HOME;
+}
+
+#ifdef LCD_BUSY_FLAG
+uint8_t lcd_busy_flag_ready = 0; // BF is only valid once the 4-bit interface is set up
+
+uint8_t DirectLCD_read_nibble(void)
 {
-    // Upper 4 bits
-	PORTD = (PORTD & 0x0F) | (cmd & 0xF0);
-	PORTD &= ~(1 << RS); // Indicate a command is coming
 	PORTB |= (1 << EN);
-	_delay_us(1);
+	hal_delay_us(1);
+	uint8_t bits = PIND & 0xF0;
 	PORTB &= ~(1 << EN);
+	hal_delay_us(1);
+	return bits;
+}
 
-    // Lower 4 bits
-	PORTD = (PORTD & 0x0F) | (cmd << 4);
-	PORTB |= (1 << EN);
-	_delay_us(1);
-	PORTB &= ~(1<<EN);
-	_delay_ms(2);
+uint8_t DirectLCD_busy(void)
+{
+	DDRD &= 0x0F; // Data lines to input
+	PORTD &= ~(1 << RS);
+	PORTB |= (1 << RW); // Read the busy flag and address counter
+	uint8_t busy = DirectLCD_read_nibble() & 0x80; // BF is D7 of the upper nibble
+	DirectLCD_read_nibble(); // The lower nibble still has to be clocked out
+	PORTB &= ~(1 << RW);
+	DDRD |= 0xF0;
+	return busy;
+}
+#endif
+
+// Shadow of DDRAM. lcd_ddram holds what the controller holds, all 40 cells of
+// each line, and lcd_shift which of them is at the left edge of the screen.
+// lcd_fb is in screen columns and holds what should be shown next; after a
+// display shift it still says the same thing, so the next flush rewrites
+// whatever has to stay put. Direct writes update both, so DirectLCD_flush()
+// only ever sends cells that went through DirectLCD_fb_*.
+#define LCD_ROWS 2
+#define LCD_COLS 16
+#define LCD_LINE 40 // DDRAM cells per line
+#define LCD_ADDR_CGRAM 0xFF
+
+uint8_t lcd_fb[LCD_ROWS][LCD_COLS];
+uint8_t lcd_ddram[LCD_ROWS][LCD_LINE];
+uint8_t lcd_addr = 0; // Mirror of the controller's address counter
+uint8_t lcd_shift = 0; // Mirror of the display shift
+uint8_t lcd_wrapped = 0; // The last write ran off the end of a line
+
+// DDRAM column shown at a screen column; columns past the right edge of the
+// screen (up to LCD_LINE - 1) name the cells that scroll in next
+uint8_t DirectLCD_cell(uint8_t col)
+{
+	col += lcd_shift;
+	return col >= LCD_LINE ? col - LCD_LINE : col;
+}
+
+void DirectLCD_track_command(uint8_t cmd)
+{
+	lcd_wrapped = 0;
+	if (cmd & 0x80) {
+		lcd_addr = cmd & 0x7F;
+	}
+	else if (cmd & 0x40) {
+		lcd_addr = LCD_ADDR_CGRAM;
+	}
+	else if ((cmd & 0xF8) == 0x18) { // Display shift
+		if (cmd & 0x04) lcd_shift = lcd_shift ? lcd_shift - 1 : LCD_LINE - 1;
+		else lcd_shift = DirectLCD_cell(1);
+	}
+	else if (cmd == 0x01) {
+		for (uint8_t row = 0; row < LCD_ROWS; row++) {
+			for (uint8_t col = 0; col < LCD_LINE; col++) {
+				lcd_ddram[row][col] = ' ';
+			}
+			for (uint8_t col = 0; col < LCD_COLS; col++) {
+				lcd_fb[row][col] = ' ';
+			}
+		}
+		lcd_addr = 0;
+		lcd_shift = 0;
+	}
+	else if ((cmd & 0xFE) == 0x02) {
+		lcd_addr = 0;
+		lcd_shift = 0;
+	}
+}
+
+void DirectLCD_track_char(uint8_t data)
+{
+	if (lcd_addr == LCD_ADDR_CGRAM) return;
+	uint8_t row = lcd_addr >> 6;
+	uint8_t col = lcd_addr & 0x3F;
+	if (col < LCD_LINE) {
+		lcd_ddram[row][col] = data;
+		uint8_t screen = col >= lcd_shift ? col - lcd_shift : col + LCD_LINE - lcd_shift;
+		if (screen < LCD_COLS) lcd_fb[row][screen] = data;
+	}
+	// Each line holds 40 cells; the counter runs from the end of one into the other
+	if (++col == LCD_LINE) {
+		lcd_addr = (row ^ 1) << 6;
+		lcd_wrapped = 1;
+	}
+	else lcd_addr++;
+}
+
+void DirectLCD_nibble(uint8_t bits)
+{
+	PORTD = (PORTD & 0x0F) | (bits & 0xF0);
+	hal_gpio_strobe(PORTB, EN);
+}
+
+// Pending transfers. Callers only enqueue; the Timer0 compare interrupt sends
+// one nibble per call and then sleeps through the settle time of the
+// instruction, so nothing on the main path waits on the bus.
+#define LCD_QUEUE_SIZE 64 // Must be a power of two
+#define LCD_Q_RS 0x80 // Flag bit: data write rather than command
+
+// Timer0 runs at F_CPU/64, i.e. 4 us per tick at 16 MHz
+#define LCD_TICK_US (64 * 1000000UL / F_CPU)
+
+uint8_t lcd_q_byte[LCD_QUEUE_SIZE];
+uint8_t lcd_q_flags[LCD_QUEUE_SIZE]; // LCD_Q_RS | settle class
+volatile uint8_t lcd_q_head = 0; // Next free slot
+volatile uint8_t lcd_q_tail = 0; // Next transfer to send
+volatile uint8_t lcd_q_busy = 0; // Timer0 is mid-transfer or settling
+uint8_t lcd_q_hwm = 0; // Deepest the queue has been
+uint8_t lcd_q_lower = 0; // Upper nibble of the tail transfer already sent
+uint16_t lcd_q_wait = 0; // Settle ticks still to run
+#ifdef LCD_BUSY_FLAG
+// Give up on BF after ~4 ms (two ticks per poll) so a disconnected display
+// cannot hang the game; the transfer then goes out regardless
+#define LCD_BUSY_POLLS 500
+uint16_t lcd_q_polls = 0; // Busy-flag polls for the tail transfer so far
+#endif
+
+uint8_t DirectLCD_queue_depth(void)
+{
+	return (lcd_q_head - lcd_q_tail) & (LCD_QUEUE_SIZE - 1);
+}
+
+uint8_t DirectLCD_queue_hwm(void)
+{
+	return lcd_q_hwm;
+}
+
+// Fire the next Timer0 compare match on the 'ticks'th timer clock from now.
+// The prescaler keeps running, so the first of those clocks can come at any
+// point up to a tick away: the wait is more than ticks - 1 ticks, at most
+// ticks. Writing TCNT0 blocks the match on the following timer clock, so
+// OCR0A must not be 0.
+void DirectLCD_queue_schedule(uint8_t ticks)
+{
+	if (ticks < 1) ticks = 1;
+	TCNT0 = 0;
+	OCR0A = ticks;
+}
+
+void DirectLCD_queue_step(void)
+{
+	if (lcd_q_wait) {
+		uint8_t ticks = lcd_q_wait > 255 ? 255 : lcd_q_wait;
+		lcd_q_wait -= ticks;
+		DirectLCD_queue_schedule(ticks);
+		return;
+	}
+	if (lcd_q_tail == lcd_q_head) {
+		TIMSK0 &= ~(1 << OCIE0A);
+		lcd_q_busy = 0;
+		return;
+	}
+
+	uint8_t data = lcd_q_byte[lcd_q_tail];
+	uint8_t flags = lcd_q_flags[lcd_q_tail];
+	if (!lcd_q_lower) {
+#ifdef LCD_BUSY_FLAG
+		if (lcd_busy_flag_ready && DirectLCD_busy() && ++lcd_q_polls < LCD_BUSY_POLLS) {
+			DirectLCD_queue_schedule(2); // Look again shortly
+			return;
+		}
+		lcd_q_polls = 0;
+#endif
+		if (flags & LCD_Q_RS) PORTD |= (1 << RS);
+		else PORTD &= ~(1 << RS);
+		DirectLCD_nibble(data); // Upper 4 bits
+		lcd_q_lower = 1;
+		DirectLCD_queue_schedule(2);
+		return;
+	}
+
+	DirectLCD_nibble(data << 4); // Lower 4 bits
+	lcd_q_lower = 0;
+	lcd_q_tail = (lcd_q_tail + 1) & (LCD_QUEUE_SIZE - 1);
+#ifdef LCD_BUSY_FLAG
+	if (lcd_busy_flag_ready) {
+		DirectLCD_queue_schedule(2);
+		return;
+	}
+#endif
+	// One tick more than the settle time, since the first one may be partial
+	uint16_t ticks = (pgm_read_word(&lcd_settle_us[flags & 0x03]) + LCD_TICK_US - 1) / LCD_TICK_US + 1;
+	lcd_q_wait = ticks > 255 ? ticks - 255 : 0;
+	DirectLCD_queue_schedule(ticks > 255 ? 255 : ticks);
+}
+
+ISR(TIMER0_COMPA_vect) {
+	ISR_PROFILE_ENTER();
+	DirectLCD_queue_step();
+	ISR_PROFILE_EXIT(ISR_ID_TIMER0_COMPA);
+}
+
+// With interrupts disabled (inside another ISR) Timer0 cannot drain the queue,
+// so wait for its compare flag and run the step by hand.
+void DirectLCD_queue_spin(void)
+{
+	if (SREG & (1 << SREG_I)) return;
+	if (!(TIFR0 & (1 << OCF0A))) return;
+	hal_clear_flag(TIFR0, OCF0A);
+	DirectLCD_queue_step();
+}
+
+void DirectLCD_enqueue(uint8_t data, uint8_t flags)
+{
+	for (EVER) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			uint8_t head = lcd_q_head;
+			uint8_t next = (head + 1) & (LCD_QUEUE_SIZE - 1);
+			if (next != lcd_q_tail) {
+				lcd_q_byte[head] = data;
+				lcd_q_flags[head] = flags;
+				lcd_q_head = next;
+				uint8_t depth = DirectLCD_queue_depth();
+				if (depth > lcd_q_hwm) lcd_q_hwm = depth;
+				if (!lcd_q_busy) {
+					lcd_q_busy = 1;
+					DirectLCD_queue_schedule(2);
+					hal_clear_flag(TIFR0, OCF0A);
+					TIMSK0 |= (1 << OCIE0A);
+				}
+				return;
+			}
+		}
+		hal_spin();
+		DirectLCD_queue_spin(); // Full
+	}
+}
+
+// Block until every queued transfer has been sent and has settled.
+void DirectLCD_fence(void)
+{
+	while (lcd_q_busy) {
+		hal_spin();
+		DirectLCD_queue_spin();
+	}
+}
+
+void DirectLCD_command(uint8_t cmd)
+{
+	DirectLCD_enqueue(cmd, DirectLCD_command_class(cmd));
+	DirectLCD_track_command(cmd);
 }
 
 
 void DirectLCD_char(uint8_t data)
 {
-    // Upper 4 bits
-	PORTD = (PORTD & 0x0F) | (data & 0xF0);
-	PORTD |= (1<<RS); // Indicate a command is coming
-	PORTB|= (1<<EN);
-	_delay_us(1);
-	PORTB &= ~ (1<<EN);
+	// With the display shifted, text can run past DDRAM column 39, which the
+	// controller continues on the other line. Keep it on its own.
+	if (lcd_wrapped) DirectLCD_command(0x80 | (lcd_addr ^ 0x40));
+	DirectLCD_enqueue(data, LCD_Q_RS | LCD_T_DATA);
+	DirectLCD_track_char(data);
+}
 
-    // Lower 4 bits
-	PORTD = (PORTD & 0x0F) | (data << 4);
-	PORTB |= (1 << EN);
-	_delay_us(1);
-	PORTB &= ~(1 << EN);
-	_delay_ms(2);
+// Address set for a screen position, honouring the display shift
+void DirectLCD_goto(uint8_t col, uint8_t row)
+{
+	uint8_t addr = (row << 6) | DirectLCD_cell(col);
+	if (lcd_addr != addr) DirectLCD_command(0x80 | addr);
 }
 
 void DirectLCD_charpos(char col, char row, uint8_t data) {
-    if (row == 0) DirectLCD_command((col & 0x0F) | 0x80);
-	else if (row == 1) DirectLCD_command((col & 0x0F) | 0xC0);
+	DirectLCD_goto(col, row);
 	DirectLCD_char(data);
 }
 
 void DirectLCD_init(void)
 {
 	DDRD = 0xFF; // Set ouput direction
-	_delay_ms(20); // Wait for the display to init
+	DDRB |= (1 << EN);
+#ifdef LCD_BUSY_FLAG
+	DDRB |= (1 << RW);
+#endif
+	hal_delay_ms(20); // Wait for the display to init
+
+	// Timer0 in CTC mode with prescaler 64 paces the transfer queue
+	TCCR0A = (1 << WGM01);
+	TCCR0B = (1 << CS01) | (1 << CS00);
 	
 	DirectLCD_command(0x02); // 4-bit init
 	DirectLCD_command(0x28); // 2 lines, 5x8 char bitmap, 4-bit mode
+#ifdef LCD_BUSY_FLAG
+	DirectLCD_fence();
+	lcd_busy_flag_ready = 1;
+#endif
 	DirectLCD_command(0x0c); // Display on and cursor off
 	DirectLCD_command(0x06); // Enable cursor increment when writing
 	DirectLCD_command(0x01); // Clear screen
-	_delay_ms(2);
 }
 
 void DirectLCD_print(const char* str)
@@ -72,77 +448,258 @@ void DirectLCD_print(const char* str)
 	}
 }
 
+void DirectLCD_print_P(PGM_P str)
+{
+	char c;
+	while ((c = pgm_read_byte(str++)) != 0)
+	{
+		DirectLCD_char(c);
+	}
+}
+
 void DirectLCD_printpos(char pos, char row, const char *str)
 {
-	if (row == 0 && pos<16) DirectLCD_command((pos & 0x0F) | 0x80);
-	else if (row == 1 && pos<16) DirectLCD_command((pos & 0x0F) | 0xC0);
+	if (row < LCD_ROWS && pos < 16) DirectLCD_goto(pos, row);
 	DirectLCD_print(str);
 }
 
+void DirectLCD_printpos_P(char pos, char row, PGM_P str)
+{
+	if (row < LCD_ROWS && pos < 16) DirectLCD_goto(pos, row);
+	DirectLCD_print_P(str);
+}
+
 void DirectLCD_clear()
 {
 	DirectLCD_command (0x01); // clear
 	DirectLCD_command (0x80); // back to home
 }
 
-void DirectLCD_register_sprite(uint8_t ref, uint8_t* sprite_bmp) {
-    ref &= 0x7; // only 1-7
-    DirectLCD_command(0x40 | (ref << 3));
-    for (int i = 0; i < 8; i++) {
-        DirectLCD_char(sprite_bmp[i]);
-    }
+void DirectLCD_fb_charpos(uint8_t col, uint8_t row, uint8_t data)
+{
+	if (col < LCD_COLS && row < LCD_ROWS) lcd_fb[row][col] = data;
+}
+
+void DirectLCD_fb_printpos(uint8_t col, uint8_t row, const char *str)
+{
+	for (; *str && col < LCD_COLS; str++, col++) {
+		DirectLCD_fb_charpos(col, row, *str);
+	}
+}
+
+void DirectLCD_fb_printpos_P(uint8_t col, uint8_t row, PGM_P str)
+{
+	char c;
+	for (; (c = pgm_read_byte(str)) != 0 && col < LCD_COLS; str++, col++) {
+		DirectLCD_fb_charpos(col, row, c);
+	}
+}
+
+// CGRAM glyph cache. The controller has eight user-defined characters
+// (codes 0-7). Glyphs are bitmaps in flash, known by their address, and get
+// a slot the first time a frame uses them; after that they cost nothing
+// until evicted. A new glyph takes a free slot, or else the least recently
+// displayed one the frame in progress doesn't use. lcd_glyph_lru orders the
+// slots from most to least recent, and lcd_glyph_frame flags those the
+// frame uses until DirectLCD_flush() ends it.
+//
+// A glyph the frame shows is uploaded whole before its cells go out. One
+// that is only needed soon (DirectLCD_glyph_prefetch_P) goes up
+// LCD_GLYPH_ROWS rows at the end of each flush instead, after the frame's
+// DDRAM writes: it never holds up a frame, and the slot it took over is no
+// longer on screen by then.
+#define LCD_GLYPH_SLOTS 8
+#define LCD_GLYPH_HEIGHT 8
+#define LCD_GLYPH_ROWS 4 // Prefetched rows uploaded per flush
+
+const uint8_t *lcd_glyph_bmp[LCD_GLYPH_SLOTS]; // Glyph in each slot, 0 if free
+uint8_t lcd_glyph_rows[LCD_GLYPH_SLOTS]; // How many of its rows are in CGRAM
+uint8_t lcd_glyph_lru[LCD_GLYPH_SLOTS] = {0, 1, 2, 3, 4, 5, 6, 7};
+uint8_t lcd_glyph_frame = 0; // One bit per slot
+
+// Move a slot to the front of the LRU order and claim it for this frame
+void DirectLCD_glyph_touch(uint8_t slot)
+{
+	uint8_t i = 0;
+	while (lcd_glyph_lru[i] != slot) i++;
+	for (; i > 0; i--) {
+		lcd_glyph_lru[i] = lcd_glyph_lru[i - 1];
+	}
+	lcd_glyph_lru[0] = slot;
+	lcd_glyph_frame |= (1 << slot);
+}
+
+// The slot holding a glyph, or one handed over to it with nothing uploaded
+// yet. LCD_GLYPH_SLOTS if the frame already uses all of them.
+uint8_t DirectLCD_glyph_slot(const uint8_t *bmp)
+{
+	for (uint8_t slot = 0; slot < LCD_GLYPH_SLOTS; slot++) {
+		if (lcd_glyph_bmp[slot] == bmp) return slot;
+	}
+	// Free slots are never touched, so they are always at the back
+	for (uint8_t i = LCD_GLYPH_SLOTS; i-- > 0;) {
+		uint8_t slot = lcd_glyph_lru[i];
+		if (!(lcd_glyph_frame & (1 << slot))) {
+			lcd_glyph_bmp[slot] = bmp;
+			lcd_glyph_rows[slot] = 0;
+			return slot;
+		}
+	}
+	return LCD_GLYPH_SLOTS;
+}
+
+// Send a slot's glyph up to row 'rows'. The address counter is left in
+// CGRAM, which DirectLCD_goto() knows to fix.
+void DirectLCD_glyph_upload(uint8_t slot, uint8_t rows)
+{
+	uint8_t row = lcd_glyph_rows[slot];
+	if (row >= rows) return;
+	DirectLCD_command(0x40 | (slot << 3) | row);
+	for (; row < rows; row++) {
+		DirectLCD_char(pgm_read_byte(&lcd_glyph_bmp[slot][row]));
+	}
+	lcd_glyph_rows[slot] = rows;
+}
+
+// Character code that shows a glyph in this frame
+uint8_t DirectLCD_glyph_P(const uint8_t *bmp)
+{
+	uint8_t slot = DirectLCD_glyph_slot(bmp);
+	if (slot == LCD_GLYPH_SLOTS) {
+		// More than eight glyphs in one frame: one of them will look wrong
+		slot = lcd_glyph_lru[LCD_GLYPH_SLOTS - 1];
+		lcd_glyph_bmp[slot] = bmp;
+		lcd_glyph_rows[slot] = 0;
+	}
+	DirectLCD_glyph_upload(slot, LCD_GLYPH_HEIGHT);
+	DirectLCD_glyph_touch(slot);
+	return slot;
+}
+
+// A glyph a later frame will show. Skipped if it would need a slot this
+// frame uses.
+void DirectLCD_glyph_prefetch_P(const uint8_t *bmp)
+{
+	uint8_t slot = DirectLCD_glyph_slot(bmp);
+	if (slot < LCD_GLYPH_SLOTS) DirectLCD_glyph_touch(slot);
+}
+
+// End of a frame: upload the next rows of prefetched glyphs
+void DirectLCD_glyph_frame_end(void)
+{
+	uint8_t budget = LCD_GLYPH_ROWS;
+	for (uint8_t slot = 0; slot < LCD_GLYPH_SLOTS && budget; slot++) {
+		uint8_t rows = lcd_glyph_rows[slot];
+		if (!lcd_glyph_bmp[slot] || rows == LCD_GLYPH_HEIGHT) continue;
+		uint8_t end = rows + budget < LCD_GLYPH_HEIGHT ? rows + budget : LCD_GLYPH_HEIGHT;
+		budget -= end - rows;
+		DirectLCD_glyph_upload(slot, end);
+	}
+	lcd_glyph_frame = 0;
+}
+
+// Send every cell where lcd_fb differs from what is on screen. Adjacent
+// changed cells go out as one address set followed by auto-incremented data
+// writes, and an unchanged frame costs no bus transactions at all. This also
+// ends the frame for the glyph cache.
+void DirectLCD_flush(void)
+{
+	for (uint8_t row = 0; row < LCD_ROWS; row++) {
+		uint8_t col = 0;
+		while (col < LCD_COLS) {
+			if (lcd_fb[row][col] == lcd_ddram[row][DirectLCD_cell(col)]) {
+				col++;
+				continue;
+			}
+			DirectLCD_goto(col, row);
+			while (col < LCD_COLS && lcd_fb[row][col] != lcd_ddram[row][DirectLCD_cell(col)]) {
+				DirectLCD_char(lcd_fb[row][col]);
+				col++;
+			}
+		}
+	}
+	DirectLCD_glyph_frame_end();
 }
 
 void DirectLCD_scroll_left(void) {
     DirectLCD_command(0x10 | 0x08 | 0x00);
 }
 
-#define EVER ;;
-
 #define EMPTY_ROW 0b00000000
 
-#define RUNNER 2
-#define OBSTACLE 1
-#define no_obstacle runner_area[1] == 32 || runner_area[1] == RUNNER
-
-char runner_area[16] = {32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32}; // 32 = space
-
-uint8_t bmp3[10] = {EMPTY_ROW,
-                   0b00111100,
-                   0b00000010,
-                   0b00000010,
-                   0b00111100,
-                   0b00000010,
-                   0b00000010,
-                   0b00000010,
-                   0b00111100,
-                   EMPTY_ROW};
-
-uint8_t bmp2[10] = {EMPTY_ROW,
-                   0b00011100,
-                   0b00100010,
-                   0b00000010,
-                   0b00000100,
-                   0b00001000,
-                   0b00010000,
-                   0b00100000,
-                   0b00111110,
-                   EMPTY_ROW};
-
-uint8_t bmp1[10] = {EMPTY_ROW,
-                   0b00000010,
-                   0b00000110,
-                   0b00001010,
-                   0b00010010,
-                   0b00000010,
-                   0b00000010,
-                   0b00000010,
-                   0b00000010,
-                   EMPTY_ROW};
-
-
-// Sprites for the game
-uint8_t runner[8] = {
+// LED matrix animations, stored in flash and played by matrix_anim_play().
+// Each frame starts with a header byte: its display time in 10 ms units
+// (1-127), with ANIM_DELTA_FLAG set if only some rows change. A key frame
+// then lists all ten rows. A delta frame lists a 10-bit mask of the rows
+// that change (low byte first), then one byte per changed row. A header of
+// ANIM_END finishes the animation.
+#define ANIM_END 0
+#define ANIM_DELTA_FLAG 0x80
+#define ANIM_KEY(ms) ((ms) / 10)
+#define ANIM_DELTA(ms, row_mask) (ANIM_DELTA_FLAG | (ms) / 10), ((row_mask) & 0xFF), ((row_mask) >> 8)
+
+const uint8_t countdown_anim[] PROGMEM = {
+    ANIM_KEY(600), // 3
+    EMPTY_ROW,
+    0b00111100,
+    0b00000010,
+    0b00000010,
+    0b00111100,
+    0b00000010,
+    0b00000010,
+    0b00000010,
+    0b00111100,
+    EMPTY_ROW,
+    ANIM_DELTA(600, 0b0111110110), // 2 shares row 3 with 3
+    0b00011100,
+    0b00100010,
+    0b00000100,
+    0b00001000,
+    0b00010000,
+    0b00100000,
+    0b00111110,
+    ANIM_KEY(600), // 1
+    EMPTY_ROW,
+    0b00000010,
+    0b00000110,
+    0b00001010,
+    0b00010010,
+    0b00000010,
+    0b00000010,
+    0b00000010,
+    0b00000010,
+    EMPTY_ROW,
+    ANIM_END
+};
+
+#define GAME_OVER_CROSS \
+    ANIM_KEY(250), \
+    EMPTY_ROW, \
+    0b00100010, \
+    0b00100010, \
+    0b00010100, \
+    0b00001000, \
+    0b00001000, \
+    0b00010100, \
+    0b00100010, \
+    0b00100010, \
+    EMPTY_ROW, \
+    ANIM_DELTA(250, 0b0111111110), \
+    EMPTY_ROW, EMPTY_ROW, EMPTY_ROW, EMPTY_ROW, EMPTY_ROW, EMPTY_ROW, EMPTY_ROW, EMPTY_ROW
+
+// A blinking cross, 2.5 s in total
+const uint8_t game_over_anim[] PROGMEM = {
+    GAME_OVER_CROSS,
+    GAME_OVER_CROSS,
+    GAME_OVER_CROSS,
+    GAME_OVER_CROSS,
+    GAME_OVER_CROSS,
+    ANIM_END
+};
+
+// Glyphs for the game, uploaded by the glyph cache as they are needed. The
+// runner alternates between two strides on the ground.
+const uint8_t runner_stride_a[8] PROGMEM = {
                 0b00000,
                 0b00111,
                 0b00111,
@@ -152,7 +709,27 @@ uint8_t runner[8] = {
                 0b01001,
                 0b00000
                 };
-uint8_t obstacle[8] = {
+const uint8_t runner_stride_b[8] PROGMEM = {
+                0b00000,
+                0b00111,
+                0b00111,
+                0b10110,
+                0b11111,
+                0b01010,
+                0b10010,
+                0b00000
+                };
+const uint8_t runner_jump[8] PROGMEM = {
+                0b00111,
+                0b00111,
+                0b10110,
+                0b11111,
+                0b01010,
+                0b10001,
+                0b00000,
+                0b00000
+                };
+const uint8_t cactus[8] PROGMEM = {
                 0b00100,
                 0b10100,
                 0b10101,
@@ -162,30 +739,83 @@ uint8_t obstacle[8] = {
                 0b00100,
                 0b00000
                 };
+const uint8_t rock[8] PROGMEM = {
+                0b00000,
+                0b00000,
+                0b00000,
+                0b00000,
+                0b01110,
+                0b11101,
+                0b11111,
+                0b00000
+                };
+const uint8_t stump[8] PROGMEM = {
+                0b00000,
+                0b00000,
+                0b01110,
+                0b10101,
+                0b01110,
+                0b01110,
+                0b01110,
+                0b00000
+                };
+
+// Indexed by obstacle type, from OBSTACLE_CACTUS
+const uint8_t *const obstacle_glyphs[OBSTACLE_TYPES] PROGMEM = {
+    cactus,
+    rock,
+    stump
+};
 
 void uart_init(void);
 void uart_putbyte(unsigned char data);
 int uart_getbyte(unsigned char *buffer);
 void uart_printf(const char* format_text, ...);
+void uart_printf_P(PGM_P format_text, ...);
+void uart_flush(void);
 void uart_receive_chars(char* buff, int buff_len);
 void game_loop(void);
 void exit_screen(void);
 void button_press_left(void);
 void button_press_right(void);
+void tick_setup(void);
+#ifdef ISR_PROFILE
+void isr_profile_poll(void);
+#endif
 
-unsigned long prev_ms = 0; // ms
-unsigned long jump_time = 0; // ms
-int jump_dur = 500; // ms
-
-unsigned long global_clock = 0; // ms since startup
+volatile unsigned long global_clock = 0; // ms since startup
 
-int scroll_speed = 300; // step size in milliseconds
-char jump = 32;
-int score = 0;
-int stop_updates_to_score = 0;
+struct game game;
+uint8_t frame_dirty = 1; // The LCD needs redrawing
 
 uint8_t pwm_comp = (uint8_t) (0.36 * 255); // DC% = sn/2 + 25. n10585222 => sn = 22. DC% = 22/2 + 25 = 36%
 
+//  Duty cycles for brightness levels 0-9, spaced evenly for the eye
+//  (255 * (level / 9) ^ 2.2).
+#define BRIGHTNESS_LEVELS 10
+const uint8_t brightness_gamma[BRIGHTNESS_LEVELS] PROGMEM = {0, 2, 9, 23, 43, 70, 105, 147, 197, 255};
+
+//  Timer2 is the tick timer (see Tick tasks): fast PWM at F_CPU/64 with TOP
+//  in OCR2A, so it wraps every millisecond.
+#define TIMER2_COUNTS_PER_MS (F_CPU / 64 / 1000UL)
+#define TIMER2_TOP (TIMER2_COUNTS_PER_MS - 1)
+
+//  PD3 is OC2B, so Timer2 drives it in hardware and brightness costs no CPU
+//  time. Output is high for about duty/256 of each 1 ms period; 0
+//  disconnects the pin because fast PWM can't reach a true 0%.
+void set_brightness(uint8_t duty) {
+    uint8_t counts = ((uint16_t) duty * (TIMER2_TOP + 1) + 128) >> 8;
+    pwm_comp = duty;
+    if (counts == 0) {
+        TCCR2A &= ~(1 << COM2B1);
+        PORTD &= ~(1 << PD3);
+    }
+    else {
+        OCR2B = counts - 1;
+        TCCR2A |= (1 << COM2B1);
+    }
+}
+
 int top_score = 0;
 int num_rounds = 1;
 unsigned char inp;
@@ -205,23 +835,33 @@ void device_setup(void) {
     DDRC &= ~(1 << SELECT);
     DDRC &= ~(1 << LEFT);
 
+    //  SELECT (PCINT9) also interrupts on every change, see select_edge()
+    PCMSK1 = (1 << PCINT9);
+    PCICR |= (1 << PCIE1);
 
-    DDRD |= (1 << PD3); // For software PWM
+    DDRD |= (1 << PD3); // OC2B, hardware PWM
 
     //  ******************************************
-    //     DIGITAL I/O: Interrupt-based debouncing
+    //     Tick timer
     //  ******************************************
     //
-    //  Debounce switches LEFT, SELECT and RIGHT using interrupts.
-    //  Use Timer2 because Timer0 is reserved for the LCD.
-    //
-    //  Initialise Timer2 in normal mode so that it overflows 
-    //  with a period of approximately 0.000128 seconds (prescaler = 8)
-    TCCR2A = 0;
-    TCCR2B = (1 << CS21);
+    //  Timer0 is reserved for the LCD, so Timer2 paces everything periodic.
+    //  Fast PWM with TOP = OCR2A (mode 7) at prescaler 64 overflows every
+    //  millisecond and generates the 1 kHz brightness PWM on OC2B.
+    OCR2A = TIMER2_TOP;
+    TCCR2A = (1 << WGM21) | (1 << WGM20);
+    TCCR2B = (1 << WGM22) | (1 << CS22);
+    set_brightness(pwm_comp);
+    tick_setup();
 
     //  Enable timer overflow interrupt for Timer 2.
-    TIMSK2 = 1;
+    TIMSK2 = (1 << TOIE2);
+
+#ifdef ISR_PROFILE
+    // Timer1 free-runs at F_CPU/8 as the profiler's clock
+    TCCR1A = 0;
+    TCCR1B = (1 << CS11);
+#endif
 
     //  Set interrupts.
     //  sei();
@@ -230,10 +870,13 @@ void device_setup(void) {
     //     ANALOG INPUT: Potentiometer
     //  ******************************************
     //
-	// ADC Enable and pre-scaler of 128
+	// ADC Enable and pre-scaler of 128, single conversions started and
+    // read by the ADC tick task (100 per second)
     // ADEN  = 1
     // ADPS2 = 1, ADPS1 = 1, ADPS0 = 1
 	ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+    ADCSRB = 0;
+    DIDR0 |= (1 << ADC5D); // The pot pin is analog only
 
     // select channel and ref input voltage
     // channel 5, PC5 (A5 on the uno)
@@ -242,142 +885,412 @@ void device_setup(void) {
     // REFS1=0
     ADMUX = (1 << REFS0);
     ADMUX |= 0b00000101;
+    ADCSRA |= (1 << ADSC); // Start the first conversion; adc_poll() starts the rest
     sei();
 }
 
+//  ******************************************
+//     LED matrix: background row scanner
+//  ******************************************
+//
+//  The decade counter on PC4 (clock) / PC3 (reset) selects one of ten rows
+//  and PB1-PB5 drive its columns. matrix_scan() is a tick task and steps to
+//  the next row every millisecond, so the matrix refreshes at a constant
+//  100 Hz whatever the main loop is doing. The step comes at the start of a
+//  brightness PWM period, so every row gets exactly one.
+//  The scanner reads the front buffer; callers fill the back buffer and
+//  swap, which takes effect at the start of the next frame.
+#define MATRIX_ROWS 10
+#define MATRIX_COLUMNS 0b00111110 // PB1-PB5
+
+#if defined(LCD_BUSY_FLAG) && ((1 << (RW)) & MATRIX_COLUMNS)
+#error "RW is on a matrix column pin, which matrix_scan() rewrites every tick"
+#endif
+
+uint8_t matrix_buffer[2][MATRIX_ROWS];
+volatile uint8_t matrix_front = 0;
+volatile uint8_t matrix_swap_pending = 0;
+uint8_t matrix_row = 0;
+
 void matrix_setup(void) {
-    DDRB |= (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 4); // Set led matrix output ports
+    DDRB |= MATRIX_COLUMNS; // Set led matrix output ports
     DDRC |= (1 << 3) | (1 << 4); // Clock and reset pins
 
     // Reset the decade counter by signalling to the reset input for a short while.
-    PORTC |= (1 << 3);
-    PORTB &= ~(1 << 3);
+    hal_gpio_strobe(PORTC, 3);
+}
 
+void matrix_scan(void) {
+    PORTB &= ~MATRIX_COLUMNS; // Clear row
+    PORTC |= (1 << 4); // Set clock to high and back to low to move to the next row.
+    PORTC &= ~(1 << 4);
+    if (++matrix_row == MATRIX_ROWS) {
+        matrix_row = 0;
+        if (matrix_swap_pending) {
+            matrix_front ^= 1;
+            matrix_swap_pending = 0;
+        }
+    }
+    PORTB |= matrix_buffer[matrix_front][matrix_row] & MATRIX_COLUMNS;
 }
-volatile uint8_t switch_counter_left = 0;
-volatile uint8_t switch_counter_select = 0;
-volatile uint8_t switch_counter_right = 0;
 
-volatile uint8_t pressed_left = 0;
-volatile uint8_t pressed_select = 0;
-volatile uint8_t pressed_right = 0;
+//  The back buffer may only be written once the previous swap has happened.
+uint8_t *matrix_back_buffer(void) {
+    while (matrix_swap_pending) {
+        hal_spin();
+    }
+    return matrix_buffer[matrix_front ^ 1];
+}
 
-volatile uint8_t prevState_left = 0;
-volatile uint8_t prevState_select = 0;
-volatile uint8_t prevState_right = 0;
+void matrix_swap(void) {
+    matrix_swap_pending = 1;
+}
 
-volatile uint16_t prevState_ADC = 1000;
+void matrix_show(const uint8_t *rows) {
+    uint8_t *back = matrix_back_buffer();
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        back[row] = rows[row];
+    }
+    matrix_swap();
+}
 
-volatile uint8_t ISRcounter = 0;
-unsigned long cycle_count = 0; // Total number of overflow interrupts since startup
+void matrix_clear(void) {
+    uint8_t *back = matrix_back_buffer();
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        back[row] = EMPTY_ROW;
+    }
+    matrix_swap();
+}
 
-#define FULLY_PRESSED 0b00011111
+//  ******************************************
+//     ISR to main loop events
+//  ******************************************
+//
+//  Interrupts only post events here; everything slow (LCD output, delays,
+//  game state changes) happens when the main loop drains them. The ISRs never
+//  nest, so together they form the single producer and the main loop is the
+//  single consumer: each index has one writer and no locking is needed.
+//  The high nibble is the event type, the low nibble an argument.
+#define EVENT_QUEUE_SIZE 16 // Must be a power of two
+
+#define EV_NONE 0x00
+#define EV_LEFT_PRESS 0x10
+#define EV_RIGHT_PRESS 0x20
+#define EV_SELECT_PRESS 0x30
+#define EV_SELECT_RELEASE 0x40
+#define EV_SPEED 0x50 // Argument: new speed level
+#define EV_TICK 0x60
+
+volatile uint8_t event_queue[EVENT_QUEUE_SIZE];
+volatile uint8_t event_head = 0; // Written by ISRs only
+volatile uint8_t event_tail = 0; // Written by the main loop only
+volatile uint8_t events_dropped = 0;
+volatile uint8_t tick_pending = 0; // At most one EV_TICK in the queue at a time
+
+void event_post(uint8_t ev) {
+    uint8_t next = (event_head + 1) & (EVENT_QUEUE_SIZE - 1);
+    if (next == event_tail) {
+        events_dropped++;
+        return;
+    }
+    event_queue[event_head] = ev;
+    event_head = next;
+}
 
-ISR(TIMER2_OVF_vect) {
-    switch_counter_left <<= 1;
-    switch_counter_select <<= 1;
-    switch_counter_right <<= 1;
+uint8_t event_get(void) {
+    uint8_t tail = event_tail;
+    if (tail == event_head) return EV_NONE;
+    uint8_t ev = event_queue[tail];
+    event_tail = (tail + 1) & (EVENT_QUEUE_SIZE - 1);
+    return ev;
+}
 
-    switch_counter_left &= FULLY_PRESSED;
-    switch_counter_select &= FULLY_PRESSED;
-    switch_counter_right &= FULLY_PRESSED;
+//  Button debouncing, all of PINC at once. Each bit has a 2-bit counter
+//  spread across debounce_ct0 and debounce_ct1 (a "vertical" counter). It
+//  counts samples that differ from the debounced state and restarts on any
+//  that agrees; on the fourth in a row (4 ms) the bit flips. That is a
+//  handful of bitwise operations per tick for all eight pins. SELECT is
+//  left out: it has a faster path of its own (see select_edge()).
+#define BUTTON_MASK ((1 << LEFT) | (1 << RIGHT))
+
+uint8_t buttons = 0; // Debounced PINC, 1 = pressed
+uint8_t debounce_ct0 = 0xFF; // Counters start reset
+uint8_t debounce_ct1 = 0xFF;
+
+void debounce(void) {
+    uint8_t change = (buttons ^ PINC) & ~(1 << SELECT);
+    debounce_ct0 = ~(debounce_ct0 & change);
+    debounce_ct1 = debounce_ct0 ^ (debounce_ct1 & change);
+    change &= debounce_ct0 & debounce_ct1; // Counters that just rolled over
+    buttons ^= change;
+
+    if (change & BUTTON_MASK) {
+        uint8_t pressed = change & buttons;
+        if (pressed & (1 << LEFT)) event_post(EV_LEFT_PRESS);
+        if (pressed & (1 << RIGHT)) event_post(EV_RIGHT_PRESS);
+    }
+}
 
-    switch_counter_left |= ((PINC >> LEFT) & 1);
-    switch_counter_select |= ((PINC >> SELECT) & 1);
-    switch_counter_right |= ((PINC >> RIGHT) & 1);
+//  ******************************************
+//     Timebase
+//  ******************************************
+//
+//  global_clock is multi-byte and written by the clock tick task, so every
+//  read takes a snapshot with interrupts off.
+unsigned long millis(void) {
+    unsigned long ms;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = global_clock;
+    }
+    return ms;
+}
 
-    //  Left switch checks
-    if (switch_counter_left == FULLY_PRESSED) {
-        pressed_left = 1;
+//  The millisecond plus Timer2's progress through the next one
+unsigned long micros(void) {
+    unsigned long ms;
+    uint8_t counts;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = global_clock;
+        counts = hal_timer2_count();
+        // The counter wrapped after interrupts went off but the tick hasn't
+        // counted it yet. A reading of TOP was taken before the wrap.
+        if ((TIFR2 & (1 << TOV2)) && counts < TIMER2_TOP) ms++;
     }
-    else if (switch_counter_left == 0) {
-        pressed_left = 0;
+    return ms * 1000 + counts * (1000 / TIMER2_COUNTS_PER_MS);
+}
+
+//  ******************************************
+//     SELECT
+//  ******************************************
+//
+//  A jump can't wait for a debouncer or for the main loop to look at the
+//  pin. SELECT's pin change interrupt takes the first edge at once and
+//  stamps it, then stops watching the pin for SELECT_LOCKOUT_MS while the
+//  contacts bounce: the debouncing comes after the edge instead of before
+//  it. The game applies the press and release at their stamped times, however
+//  late the loop gets to them.
+#define SELECT_LOCKOUT_MS 8
+
+volatile unsigned long select_press_ms = 0;
+volatile unsigned long select_release_ms = 0;
+volatile unsigned long select_press_us = 0; // For the latency telemetry
+uint8_t select_lockout = 0; // Ticks before the pin is watched again
+
+void select_edge(void) {
+    buttons ^= (1 << SELECT);
+    if (buttons & (1 << SELECT)) {
+        select_press_ms = millis();
+        select_press_us = micros();
+        event_post(EV_SELECT_PRESS);
     }
-    if ((pressed_left == 1) & (prevState_left == 0)) {
-        button_press_left();
+    else {
+        select_release_ms = millis();
+        event_post(EV_SELECT_RELEASE);
     }
-    prevState_left = pressed_left;
+    PCMSK1 &= ~(1 << PCINT9);
+    select_lockout = SELECT_LOCKOUT_MS;
+}
 
-    //  Select switch checks
-    if (switch_counter_select == FULLY_PRESSED) {
-        pressed_select = 1;
-    }
-    else if (switch_counter_select == 0) {
-        pressed_select = 0;
+ISR(PCINT1_vect) {
+    ISR_PROFILE_ENTER();
+    // A bounce can be over before the ISR reads the pin
+    if ((PINC ^ buttons) & (1 << SELECT)) select_edge();
+    ISR_PROFILE_EXIT(ISR_ID_PCINT1);
+}
+
+//  Tick task: end the lockout. If the button changed again in the meantime
+//  that is the next edge, a few milliseconds late. The pin is watched again
+//  before it is read, so an edge in between raises the flag; PCINT1_vect
+//  checks the pin itself and does nothing if this already took the change.
+void select_poll(void) {
+    if (select_lockout == 0 || --select_lockout) return;
+    hal_clear_flag(PCIFR, PCIF1);
+    PCMSK1 |= (1 << PCINT9);
+    if ((PINC ^ buttons) & (1 << SELECT)) select_edge();
+}
+
+//  The stamps are multi-byte and written by ISRs
+unsigned long select_stamp(const volatile unsigned long *stamp) {
+    unsigned long t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = *stamp;
     }
+    return t;
+}
 
-    prevState_select = pressed_select;
+//  Input-to-state latency: from the SELECT edge to the runner leaving the
+//  ground in the game state, per round
+struct input_latency {
+    uint16_t jumps;
+    unsigned long total_us; // unsigned long for uart_printf's %lu
+    unsigned long max_us;
+};
+struct input_latency jump_latency;
+
+void jump_latency_add(void) {
+    unsigned long us = micros() - select_stamp(&select_press_us);
+    jump_latency.jumps++;
+    jump_latency.total_us += us;
+    if (us > jump_latency.max_us) jump_latency.max_us = us;
+}
 
-    //  Right switch checks
-    if (switch_counter_right == FULLY_PRESSED) {
-        pressed_right = 1;
+//  Potentiometer speed control. adc_poll() sums ADC_OVERSAMPLE readings into
+//  one 12-bit value (4x the 10-bit scale) and only changes speed_level once
+//  that value is ADC_HYSTERESIS past a threshold, so pot noise can't flicker it.
+#define ADC_OVERSAMPLE 16
+#define ADC_HYSTERESIS 32 // 12-bit counts, i.e. 8 steps of the raw reading
+
+const char speed_label_slow[] PROGMEM = "Slow     ";
+const char speed_label_medium[] PROGMEM = "Medium   ";
+const char speed_label_fast[] PROGMEM = "Fast     ";
+const char speed_label_very_fast[] PROGMEM = "Very fast";
+
+//  Indexed like the game's speed settings
+const char *const speed_labels[SPEED_LEVELS] PROGMEM = {
+    speed_label_slow,
+    speed_label_medium,
+    speed_label_fast,
+    speed_label_very_fast
+};
+const uint16_t speed_threshold[SPEED_LEVELS - 1] PROGMEM = {250 * 4, 500 * 4, 750 * 4};
+
+volatile uint8_t speed_level = 0;
+uint16_t adc_sum = 0;
+uint8_t adc_samples = 0;
+
+void adc_settle(uint16_t reading) {
+    uint8_t level = speed_level;
+    while (level < SPEED_LEVELS - 1 && reading > pgm_read_word(&speed_threshold[level]) + ADC_HYSTERESIS) {
+        level++;
     }
-    else if (switch_counter_right == 0) {
-        pressed_right = 0;
+    while (level > 0 && reading <= pgm_read_word(&speed_threshold[level - 1]) - ADC_HYSTERESIS) {
+        level--;
     }
-    if (pressed_right > prevState_right) {
-        button_press_right();
+    if (level != speed_level) {
+        speed_level = level;
+        event_post(EV_SPEED | level);
     }
-    prevState_right = pressed_right;
+}
 
-    //  Reading off ADC
-    //  Start single conversion by setting ADSC bit in ADCSRA
-	ADCSRA |= (1 << ADSC);
+//  Tick task: take the conversion started last time and start the next.
+//  At 100 samples a second a speed change settles in 160 ms, and the
+//  conversion (~104 us) is long done when the next tick comes round.
+void adc_poll(void) {
+    adc_sum += hal_adc_read();
+    ADCSRA |= (1 << ADSC);
+    if (++adc_samples == ADC_OVERSAMPLE) {
+        adc_settle(adc_sum >> 2); // 16 x 10 bit decimated to 12 bit
+        adc_sum = 0;
+        adc_samples = 0;
+    }
+}
 
-	//  Wait for ADSC bit to clear, signalling conversion complete.
-	while (ADCSRA & (1 << ADSC)) {}
+//  ******************************************
+//     Tick tasks
+//  ******************************************
+//
+//  Timer2 overflows once a millisecond and its ISR runs every periodic job
+//  from this table, each every divider ticks. phase staggers jobs with the
+//  same divider so they don't all land on one tick. Adding a job is a line
+//  here, not another interrupt source.
+struct tick_task {
+    void (*run)(void);
+    uint8_t divider; // Ticks between runs
+    uint8_t phase; // Ticks before the first run, less than divider
+};
+
+void clock_tick(void) {
+    global_clock++;
+}
 
-	// Result now available in ADC
-    // ADC returns value between 0 and 1000
-	uint16_t adc_val = ADC;
+//  EV_TICK drives the LCD frame rate and the menus
+void event_tick(void) {
+    if (!tick_pending) {
+        tick_pending = 1;
+        event_post(EV_TICK);
+    }
+}
 
-    if (adc_val != prevState_ADC) {
-        if (adc_val <= 250) {
-            //DirectLCD_set_cursor(0,0);
-            DirectLCD_printpos(0, 0, "Slow     ");
-            scroll_speed = 300;
-            jump_dur = 500;
-        }
-        else if (adc_val <= 500) {
-            //DirectLCD_set_cursor(0,0);
-            DirectLCD_printpos(0, 0, "Medium   ");
-            scroll_speed = 200;
-            jump_dur = 380;
-        }
-        else if (adc_val <= 750) {
-            //DirectLCD_set_cursor(0,0);
-            DirectLCD_printpos(0,0,"Fast     ");
-            scroll_speed = 100;
-            jump_dur = 180;
-        }
-        else {
-            //DirectLCD_set_cursor(0,0);
-            DirectLCD_printpos(0,0,"Very fast");
-            scroll_speed = 40;
-            jump_dur = 90;
-        }
-        prevState_ADC = adc_val;
+const struct tick_task tick_tasks[] PROGMEM = {
+    {clock_tick, 1, 0},
+    {debounce, 1, 0},
+    {select_poll, 1, 0},
+    {matrix_scan, 1, 0},
+    {adc_poll, 10, 5},
+    {event_tick, 10, 0}
+};
+#define TICK_TASKS (sizeof(tick_tasks) / sizeof(tick_tasks[0]))
+
+uint8_t tick_countdown[TICK_TASKS];
+
+void tick_setup(void) {
+    for (uint8_t i = 0; i < TICK_TASKS; i++) {
+        tick_countdown[i] = pgm_read_byte(&tick_tasks[i].phase);
     }
+}
 
-    // Software PWM
-    if(ISRcounter < pwm_comp) {
-		PORTD |= (1 << 3); // Set port B3 high
-	}
-    else {
-		PORTD &= ~(1 << 3); // Set low
-	}
-    ISRcounter++;
+ISR(TIMER2_OVF_vect) {
+    ISR_PROFILE_ENTER();
+    ISR_PROFILE_TIMER2();
+    for (uint8_t i = 0; i < TICK_TASKS; i++) {
+        if (tick_countdown[i] == 0) {
+            tick_countdown[i] = pgm_read_byte(&tick_tasks[i].divider);
+            ((void (*)(void)) pgm_read_ptr(&tick_tasks[i].run))();
+        }
+        tick_countdown[i]--;
+    }
+    ISR_PROFILE_EXIT(ISR_ID_TIMER2_OVF);
+}
 
-    //  Clock
-    cycle_count++;
+//  Apply a settled speed level and show its label.
+void apply_speed(uint8_t level) {
+    game_set_speed(&game, level);
+    DirectLCD_fb_printpos_P(0, 0, (PGM_P) pgm_read_ptr(&speed_labels[level]));
+    frame_dirty = 1;
 }
 
 int continue_game = 1;
+uint8_t select_held = 0;
+unsigned long round_start_ms = 0;
+
+//  Drain everything the ISRs posted since the last pass. Returns nonzero if
+//  anything besides a tick came in.
+uint8_t handle_events(void) {
+#ifdef ISR_PROFILE
+    isr_profile_poll();
+#endif
+    uint8_t ev;
+    uint8_t input = 0;
+    while ((ev = event_get()) != EV_NONE) {
+        if ((ev & 0xF0) != EV_TICK) input = 1;
+        switch (ev & 0xF0) {
+            case EV_LEFT_PRESS: button_press_left(); break;
+            case EV_RIGHT_PRESS: button_press_right(); break;
+            case EV_SELECT_PRESS:
+                select_held = 1;
+                // A press from before the round (the countdown) is only a hold
+                if (deadline_reached(select_stamp(&select_press_ms), round_start_ms) &&
+                    (game_press(&game, select_stamp(&select_press_ms)) & GAME_MOVED)) {
+                    frame_dirty = 1;
+                    jump_latency_add();
+                }
+                break;
+            case EV_SELECT_RELEASE:
+                if (select_held) game_release(&game, select_stamp(&select_release_ms));
+                select_held = 0;
+                break;
+            case EV_SPEED: apply_speed(ev & 0x0F); break;
+            case EV_TICK: tick_pending = 0; break;
+        }
+    }
+    return input;
+}
+
 //  Control buttons
 void button_press_left(void) {
     continue_game = 0;
     exit_screen();
-    _delay_ms(1000);
+    hal_delay_ms(1000);
     num_rounds = 0;
 }
 
@@ -385,39 +1298,242 @@ void button_press_right(void) {
     num_rounds++;
 }
 
+//  ******************************************
+//     UART: interrupt-driven ring buffers
+//  ******************************************
+//
+//  uart_putbyte only queues a byte for USART_UDRE_vect, and USART_RX_vect
+//  fills a receive buffer that uart_getbyte reads from. Pick the baud rate at
+//  build time with -DBAUD=115200 (or 250000, 500000, 1000000). U2X is always
+//  on since it halves the rounding error of the divider.
+#ifndef BAUD
+#define BAUD 9600UL
+#endif
+#define UART_BAUD_TOL 25 // Largest tolerated baud rate error, per mille
+
+#define UART_UBRR ((F_CPU + 4UL * BAUD) / (8UL * BAUD) - 1)
+#define UART_REAL_BAUD (F_CPU / (8UL * (UART_UBRR + 1)))
+#if UART_UBRR > 4095
+#error "BAUD is too low for F_CPU with U2X"
+#endif
+#if UART_REAL_BAUD * 1000 > BAUD * (1000 + UART_BAUD_TOL) || UART_REAL_BAUD * 1000 < BAUD * (1000 - UART_BAUD_TOL)
+#error "BAUD cannot be generated from F_CPU within UART_BAUD_TOL"
+#endif
+
+#define UART_TX_SIZE 64 // Must be a power of two
+#define UART_RX_SIZE 32 // Must be a power of two
+
+uint8_t uart_tx_buf[UART_TX_SIZE];
+volatile uint8_t uart_tx_head = 0;
+volatile uint8_t uart_tx_tail = 0;
+uint8_t uart_rx_buf[UART_RX_SIZE];
+volatile uint8_t uart_rx_head = 0;
+volatile uint8_t uart_rx_tail = 0;
+volatile uint8_t uart_rx_overflows = 0;
+
 void uart_init(void) {
-    UBRR0 = F_CPU / 16 / 9600 - 1;
-    UCSR0A = 0;
-    UCSR0B = (1 << RXEN0) | (1 << TXEN0);
+    UBRR0 = UART_UBRR;
+    UCSR0A = (1 << U2X0);
+    UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
     UCSR0C = (3 << UCSZ00);
 }
 
+void uart_tx_step(void) {
+    uint8_t tail = uart_tx_tail;
+    if (tail == uart_tx_head) {
+        UCSR0B &= ~(1 << UDRIE0); // Nothing left to send
+        return;
+    }
+    hal_uart_write(uart_tx_buf[tail]);
+    uart_tx_tail = (tail + 1) & (UART_TX_SIZE - 1);
+}
+
+ISR(USART_UDRE_vect) {
+    ISR_PROFILE_ENTER();
+    uart_tx_step();
+    ISR_PROFILE_EXIT(ISR_ID_USART_UDRE);
+}
+
+ISR(USART_RX_vect) {
+    ISR_PROFILE_ENTER();
+    uint8_t data = hal_uart_read();
+    uint8_t next = (uart_rx_head + 1) & (UART_RX_SIZE - 1);
+    if (next == uart_rx_tail) {
+        uart_rx_overflows++;
+    }
+    else {
+        uart_rx_buf[uart_rx_head] = data;
+        uart_rx_head = next;
+    }
+    ISR_PROFILE_EXIT(ISR_ID_USART_RX);
+}
+
 void uart_putbyte(unsigned char data) {
-    // Wait for empty transmit buffer
-    while (!(UCSR0A & (1 << UDRE0)));
+    uint8_t head = uart_tx_head;
+    uint8_t next = (head + 1) & (UART_TX_SIZE - 1);
+    // Wait for room. With interrupts off the UDRE interrupt can't make any,
+    // so feed the data register by hand.
+    while (next == uart_tx_tail) {
+        if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0))) {
+            uart_tx_step();
+        }
+        hal_spin();
+    }
+    uart_tx_buf[head] = data;
+    uart_tx_head = next;
+    UCSR0B |= (1 << UDRIE0);
+}
+
+//  Block until everything queued has left the data register.
+void uart_flush(void) {
+    while (uart_tx_head != uart_tx_tail) {
+        hal_spin();
+    }
+    while (!(UCSR0A & (1 << UDRE0))) {
+        hal_spin();
+    }
+}
+
+//  Decimal digits by repeated subtraction of powers of ten. This avoids the
+//  generic 32-bit division routine entirely: at most 9 subtractions per digit.
+const uint32_t pow10_table[10] PROGMEM = {
+    1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+    10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+//  Write the digits of value to out (not terminated) and return their count.
+uint8_t format_udec(char *out, uint32_t value) {
+    uint8_t len = 0;
+    for (uint8_t i = 0; i < 10; i++) {
+        uint32_t step = pgm_read_dword(&pow10_table[i]);
+        char digit = '0';
+        while (value >= step) {
+            value -= step;
+            digit++;
+        }
+        if (len || digit != '0' || i == 9) out[len++] = digit;
+    }
+    return len;
+}
+
+uint8_t format_hex(char *out, uint32_t value) {
+    uint8_t len = 0;
+    for (int8_t shift = 28; shift >= 0; shift -= 4) {
+        uint8_t nibble = (value >> shift) & 0x0F;
+        if (len || nibble || shift == 0) out[len++] = nibble < 10 ? '0' + nibble : 'a' + nibble - 10;
+    }
+    return len;
+}
+
+//  Formatted output to serial. Supports %d %u %x %s %c and %%, an optional
+//  l length modifier, and a field width with optional 0 padding ("%05u").
+//  %S prints a string from flash. The format itself is read from flash when
+//  format_in_flash is set (see uart_printf_P). Output goes straight into the
+//  TX ring.
+#define NEXT_FORMAT_CHAR() (format_in_flash ? pgm_read_byte(format_text++) : *format_text++)
+
+void uart_vprintf(const char* format_text, uint8_t format_in_flash, va_list format_vars) {
+    char c;
+    while ((c = NEXT_FORMAT_CHAR())) {
+        if (c != '%') {
+            uart_putbyte(c);
+            continue;
+        }
+
+        char pad = ' ';
+        uint8_t width = 0;
+        uint8_t is_long = 0;
+        c = NEXT_FORMAT_CHAR();
+        if (c == '0') {
+            pad = '0';
+            c = NEXT_FORMAT_CHAR();
+        }
+        while (c >= '0' && c <= '9') {
+            width = width * 10 + (c - '0');
+            c = NEXT_FORMAT_CHAR();
+        }
+        if (c == 'l') {
+            is_long = 1;
+            c = NEXT_FORMAT_CHAR();
+        }
 
-    // Send data by assigning into UDR0
-    UDR0 = data;
+        char digits[10];
+        const char *str = digits;
+        uint8_t len = 0;
+        uint8_t negative = 0;
+        uint8_t str_in_flash = 0;
+        uint32_t value;
+        switch (c) {
+            case 'd':
+                {
+                    int32_t signed_value = is_long ? va_arg(format_vars, long) : va_arg(format_vars, int);
+                    negative = signed_value < 0;
+                    value = negative ? 0UL - (uint32_t) signed_value : (uint32_t) signed_value;
+                    len = format_udec(digits, value);
+                }
+                break;
+            case 'u':
+                value = is_long ? va_arg(format_vars, unsigned long) : va_arg(format_vars, unsigned int);
+                len = format_udec(digits, value);
+                break;
+            case 'x':
+                value = is_long ? va_arg(format_vars, unsigned long) : va_arg(format_vars, unsigned int);
+                len = format_hex(digits, value);
+                break;
+            case 's':
+                str = va_arg(format_vars, const char*);
+                while (str[len]) len++;
+                break;
+            case 'S':
+                str = va_arg(format_vars, PGM_P);
+                str_in_flash = 1;
+                while (pgm_read_byte(str + len)) len++;
+                break;
+            case 'c':
+                digits[0] = (char) va_arg(format_vars, int);
+                len = 1;
+                break;
+            case 0:
+                return; // Format ended in the middle of a conversion
+            default:
+                digits[0] = c; // "%%" and anything unsupported print as-is
+                len = 1;
+                break;
+        }
+
+        // The sign counts towards the width and goes in front of zero padding
+        uint8_t total = len + negative;
+        if (negative && pad == '0') uart_putbyte('-');
+        while (width > total) {
+            uart_putbyte(pad);
+            width--;
+        }
+        if (negative && pad == ' ') uart_putbyte('-');
+        while (len--) uart_putbyte(str_in_flash ? pgm_read_byte(str++) : *str++);
+    }
 }
 
-//  Formatted output to serial
-char serial_buffer[100];
 void uart_printf(const char* format_text, ...) {
     va_list format_vars; // List of arguments
     va_start(format_vars, format_text); // Initialise format_vars to retrieve all arguments after format_text
-    vsnprintf(serial_buffer, sizeof(serial_buffer), format_text, format_vars); // Store a string in the buffer, formatted as if it was in printf. In other words, printf to buffer.
-    for (int i = 0; serial_buffer[i]; i++) {
-        uart_putbyte(serial_buffer[i]);
-    }
+    uart_vprintf(format_text, 0, format_vars);
     va_end(format_vars); // Clear memory reserved for the argument list
 }
 
+void uart_printf_P(PGM_P format_text, ...) {
+    va_list format_vars;
+    va_start(format_vars, format_text);
+    uart_vprintf(format_text, 1, format_vars);
+    va_end(format_vars);
+}
+
 int uart_getbyte(unsigned char *buffer) {
     // If receive buffer contains data...
-    if (UCSR0A & (1 << RXC0)) {
-        // Copy received byte from UDR0 into memory location (*buffer)
-        *buffer = UDR0;
-        // 
+    uint8_t tail = uart_rx_tail;
+    if (tail != uart_rx_head) {
+        // Copy the oldest received byte into memory location (*buffer)
+        *buffer = uart_rx_buf[tail];
+        uart_rx_tail = (tail + 1) & (UART_RX_SIZE - 1);
         return 1;
     }
     else {
@@ -429,7 +1545,9 @@ void uart_receive_chars(char* buff, int buff_len) {
     int i = 0;
     unsigned char ch;
     for(EVER) {
-        while(!uart_getbyte(&ch)) {}
+        while(!uart_getbyte(&ch)) {
+            hal_spin();
+        }
         if (ch == 0) {
             break;
         }
@@ -441,27 +1559,103 @@ void uart_receive_chars(char* buff, int buff_len) {
     buff[i] = 0;
 }
 
+#ifdef ISR_PROFILE
+//  ISR profiler report, see the top of the file
+const char isr_name_pcint1[] PROGMEM = "PCINT1      ";
+const char isr_name_timer0_compa[] PROGMEM = "TIMER0_COMPA";
+const char isr_name_timer2_ovf[] PROGMEM = "TIMER2_OVF  ";
+const char isr_name_usart_rx[] PROGMEM = "USART_RX    ";
+const char isr_name_usart_udre[] PROGMEM = "USART_UDRE  ";
+
+PGM_P const isr_names[ISR_PROFILE_COUNT] PROGMEM = {
+    isr_name_pcint1,
+    isr_name_timer0_compa,
+    isr_name_timer2_ovf,
+    isr_name_usart_rx,
+    isr_name_usart_udre
+};
+
+//  Timer1 counts as microseconds with one decimal
+void isr_profile_print_us(uint32_t counts) {
+    unsigned long tenths = counts * 10 / ISR_PROFILE_COUNTS_PER_US;
+    uart_printf_P(PSTR(" %5lu.%lu"), tenths / 10, tenths % 10);
+}
+
+void isr_profile_report(void) {
+    unsigned long elapsed_ms = millis() - isr_profile_start_ms;
+    uint32_t busy = 0;
+
+    uart_printf_P(PSTR("ISR profile over %lu ms\n"), elapsed_ms);
+    uart_printf_P(PSTR("isr             calls  min us  avg us  max us | <2 <4 <8 <16 <32 <64 <128 more\n"));
+    for (uint8_t id = 0; id < ISR_PROFILE_COUNT; id++) {
+        struct isr_stats stats;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            stats = isr_stats[id];
+        }
+        busy += stats.total;
+        uart_printf_P(PSTR("%S %8lu"), (PGM_P) pgm_read_ptr(&isr_names[id]), (unsigned long) stats.calls);
+        isr_profile_print_us(stats.min);
+        isr_profile_print_us(stats.calls ? stats.total / stats.calls : 0);
+        isr_profile_print_us(stats.max);
+        uart_printf_P(PSTR(" |"));
+        for (uint8_t bucket = 0; bucket < ISR_PROFILE_BUCKETS; bucket++) {
+            uart_printf_P(PSTR(" %u"), stats.histogram[bucket]);
+        }
+        uart_putbyte('\n');
+    }
+
+    // Microseconds busy per millisecond is per mille
+    unsigned long permille = elapsed_ms ? busy / ISR_PROFILE_COUNTS_PER_US / elapsed_ms : 0;
+    uart_printf_P(PSTR("CPU in ISRs: %lu.%lu%%\n"), permille / 10, permille % 10);
+
+    // Both are 16 bits wide and written by ISRs
+    uint16_t lost, nested;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        lost = isr_timer2_lost;
+        nested = isr_nested;
+    }
+    uart_printf_P(PSTR("Timer2 overflows lost: %u, nested ISRs: %u\n"), lost, nested);
+}
+
+void isr_profile_reset(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t id = 0; id < ISR_PROFILE_COUNT; id++) {
+            isr_stats[id] = (struct isr_stats) {0};
+        }
+        isr_nested = 0;
+        isr_timer2_lost = 0;
+    }
+    isr_profile_start_ms = millis();
+}
+
+//  '?' prints the report, '!' starts over
+void isr_profile_poll(void) {
+    unsigned char c;
+    if (!uart_getbyte(&c)) return;
+    if (c == '?') isr_profile_report();
+    else if (c == '!') isr_profile_reset();
+}
+#endif
+
 void serial_greeting(void) {
     //  ******************************************
     //     Serial greeting
     //  ******************************************
 
-    char str_top_score[5]; // for some reason uart_printf does not support %d formatting so I have to use a string to display it...
-    itoa(top_score, str_top_score, 10);
-
-    uart_printf("Welcome to MicroDino!\n");
-    uart_printf("The current top score is %s\n", str_top_score);
-    uart_printf("Please select an option (a-c):\n");
-    uart_printf("a) Just play a round!\n");
-    uart_printf("b) Play a 10-round tournament.\n");
-    uart_printf("c) Select map and play a round.\n");
-    uart_printf("d) Change LED brightness and play a round.\n");
-    uart_printf("Best of luck!\n");
-
-    while(!(UCSR0A & (1 << RXC0))) {_delay_ms(100);} // Wait for user input
-    uart_getbyte(&inp);
+    uart_printf_P(PSTR("Welcome to MicroDino!\n"));
+    uart_printf_P(PSTR("The current top score is %d\n"), top_score);
+    uart_printf_P(PSTR("Please select an option (a-c):\n"));
+    uart_printf_P(PSTR("a) Just play a round!\n"));
+    uart_printf_P(PSTR("b) Play a 10-round tournament.\n"));
+    uart_printf_P(PSTR("c) Select map and play a round.\n"));
+    uart_printf_P(PSTR("d) Change LED brightness and play a round.\n"));
+    uart_printf_P(PSTR("Best of luck!\n"));
+
+    while(!uart_getbyte(&inp)) { // Wait for user input
+        hal_spin();
+    }
 
-    uart_printf("Selected option: %c\n", inp);
+    uart_printf_P(PSTR("Selected option: %c\n"), inp);
 
     if (inp == 'a') {
         num_rounds = 1;
@@ -471,189 +1665,237 @@ void serial_greeting(void) {
     }
     else if (inp == 'c') {
         num_rounds = 1;
-        uart_printf("Enter a number (1-9):\n");
-        while(!(UCSR0A & (1 << RXC0))) {_delay_ms(100);}
-        uart_getbyte(&inp);
-        uart_printf("Selected map %c\n", inp);
-        srand(inp);
+        uart_printf_P(PSTR("Enter a number (1-9). Maps 1-%d are designed, the rest random:\n"), LEVEL_MAPS);
+        while(!uart_getbyte(&inp)) {
+            hal_spin();
+        }
+        uart_printf_P(PSTR("Selected map %c\n"), inp);
+        world_select_map(&game, inp);
     }
     else if (inp == 'd') {
         num_rounds = 1;
-        uart_printf("Select brightness level (a-b):\n");
-        uart_printf("a) High\n");
-        uart_printf("b) Dimmed\n");
-        while(!(UCSR0A & (1 << RXC0))) {_delay_ms(100);}
-        uart_getbyte(&inp);
+        uart_printf_P(PSTR("Select brightness level (a-b, or 0-9):\n"));
+        uart_printf_P(PSTR("a) High\n"));
+        uart_printf_P(PSTR("b) Dimmed\n"));
+        uart_printf_P(PSTR("0-9) Off to full, in even steps\n"));
+        while(!uart_getbyte(&inp)) {
+            hal_spin();
+        }
         if (inp == 'a') {
-            pwm_comp = 250;
-            uart_printf("Brightness set to high\n");
+            set_brightness(250);
+            uart_printf_P(PSTR("Brightness set to high\n"));
         }
         if (inp == 'b') {
-            pwm_comp = 100;
-            uart_printf("Brightness set to low\n");
+            set_brightness(100);
+            uart_printf_P(PSTR("Brightness set to low\n"));
+        }
+        if (inp >= '0' && inp <= '9') {
+            set_brightness(pgm_read_byte(&brightness_gamma[inp - '0']));
+            uart_printf_P(PSTR("Brightness set to level %c\n"), inp);
         }
     }
-    else {uart_printf("Invalid selection.\n");}
+    else {uart_printf_P(PSTR("Invalid selection.\n"));}
 
 }
 
-void matrix_display_bmp3(void) {
-    for (int frame = 0; frame < 60; frame++) {
-        for (int row = 0; row < 10; row++) {
-            PORTB |= bmp3[row];
-            _delay_ms(1);
-            PORTB &= ~(0b00111110); // Clear row
-            PORTC |= (1 << 4); // Set clock to high and back to low to move to the next row.
-            PORTC &= ~(1 << 4);
-        }
-    }
+//  Animation player. Deltas are applied to anim_rows, which always holds the
+//  frame on show, and frame times add up from the start so they don't drift.
+const uint8_t *anim_pos = 0; // Next frame header in flash, 0 when idle
+unsigned long anim_next_ms = 0;
+uint8_t anim_rows[MATRIX_ROWS];
+
+void matrix_anim_start(const uint8_t *anim) {
+    anim_pos = anim;
+    anim_next_ms = millis();
 }
 
-void matrix_display_bmp2(void) {
-    for (int frame = 0; frame < 60; frame++) {
-        for (int row = 0; row < 10; row++) {
-            PORTB |= bmp2[row];
-            _delay_ms(1);
-            PORTB &= ~(0b00111110); // Clear row
-            PORTC |= (1 << 4); // Set clock to high and back to low to move to the next row.
-            PORTC &= ~(1 << 4);
+//  Show the next frame if it is due. Returns 0 once the animation is over.
+uint8_t matrix_anim_update(void) {
+    if (!anim_pos) return 0;
+    if (!deadline_reached(millis(), anim_next_ms)) return 1;
+
+    uint8_t header = pgm_read_byte(anim_pos++);
+    if (header == ANIM_END) {
+        anim_pos = 0;
+        return 0;
+    }
+    if (header & ANIM_DELTA_FLAG) {
+        uint16_t changed = pgm_read_byte(anim_pos) | (pgm_read_byte(anim_pos + 1) << 8);
+        anim_pos += 2;
+        for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+            if (changed & (1 << row)) anim_rows[row] = pgm_read_byte(anim_pos++);
+        }
+    }
+    else {
+        for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+            anim_rows[row] = pgm_read_byte(anim_pos++);
         }
     }
+    matrix_show(anim_rows);
+    anim_next_ms += (header & ~ANIM_DELTA_FLAG) * 10;
+    return 1;
 }
 
-void matrix_display_bmp1(void) {
-    for (int frame = 0; frame < 60; frame++) {
-        for (int row = 0; row < 10; row++) {
-            PORTB |= bmp1[row];
-            _delay_ms(1);
-            PORTB &= ~(0b00111110); // Clear row
-            PORTC |= (1 << 4); // Set clock to high and back to low to move to the next row.
-            PORTC &= ~(1 << 4);
-        }
+void matrix_anim_play(const uint8_t *anim) {
+    matrix_anim_start(anim);
+    while (matrix_anim_update()) {
+        hal_spin();
     }
 }
 
 void lcd_greeting(void) {
-    DirectLCD_register_sprite(RUNNER, runner);
-    DirectLCD_register_sprite(OBSTACLE, obstacle);
-
-    DirectLCD_printpos(5,0,"Welcome to");
-    _delay_ms(500);
+    DirectLCD_printpos_P(5, 0, PSTR("Welcome to"));
+    hal_delay_ms(500);
     for (int i = 0; i < 5; i++) {
         DirectLCD_scroll_left();
-      	_delay_ms(150);
+      	hal_delay_ms(150);
     }
-    DirectLCD_printpos(5,1,"MicroDino!");
-    _delay_ms(1500);
+    DirectLCD_printpos_P(0, 1, PSTR("MicroDino!"));
+    hal_delay_ms(1500);
     DirectLCD_clear();
 
-    DirectLCD_printpos(0,0,"Follow serial to");
-    DirectLCD_printpos(0,1,"play");
+    DirectLCD_printpos_P(0, 0, PSTR("Follow serial to"));
+    DirectLCD_printpos_P(0, 1, PSTR("play"));
 }
 
 void exit_screen(void) {
     DirectLCD_clear();
-    DirectLCD_print("See you soon!");
+    DirectLCD_print_P(PSTR("See you soon!"));
 }
 
-void update_lcd() {
-    for (int i = 0; i <= 15; i++) {
-        DirectLCD_charpos(i, 1, runner_area[i]);
-    }
-    DirectLCD_charpos(1, 0, jump);
+//  LCD character for a world cell
+uint8_t cell_char(uint8_t cell) {
+    if (!is_obstacle(cell)) return cell;
+    return DirectLCD_glyph_P(pgm_read_ptr(&obstacle_glyphs[cell - OBSTACLE_CACTUS]));
 }
 
-void draw_bounds() {
-    runner_area[0] = 32;
-    runner_area[15] = 32;
+void update_lcd() {
+    for (uint8_t col = 0; col < WORLD_VIEW; col++) {
+        DirectLCD_fb_charpos(col, 1, cell_char(world_cell(&game, col)));
+    }
+    // Obstacles in the lookahead get their glyphs before they scroll in
+    for (uint8_t col = WORLD_VIEW; col < WORLD_VIEW + WORLD_LOOKAHEAD; col++) {
+        uint8_t cell = world_cell(&game, col);
+        if (is_obstacle(cell)) {
+            DirectLCD_glyph_prefetch_P(pgm_read_ptr(&obstacle_glyphs[cell - OBSTACLE_CACTUS]));
+        }
+    }
+    if (game.airborne) {
+        DirectLCD_fb_charpos(RUNNER_COL, 0, DirectLCD_glyph_P(runner_jump));
+    }
+    else {
+        const uint8_t *stride = (game.scrolled & 1) ? runner_stride_b : runner_stride_a;
+        DirectLCD_fb_charpos(RUNNER_COL, 1, DirectLCD_glyph_P(stride));
+        DirectLCD_fb_charpos(RUNNER_COL, 0, EMPTY_CELL);
+    }
 }
 
-char cur_score[5];
+char cur_score[6];
 void print_score() {
-    itoa(score, cur_score, 10);
-    DirectLCD_printpos(11,0,cur_score);
+    cur_score[format_udec(cur_score, game.score)] = 0;
+    DirectLCD_fb_printpos(11,0,cur_score);
 }
 
 void game_over() {
-    DirectLCD_printpos(4,1,"Game over!");
-    if (score > top_score) {
-        top_score = score;
-        char new_top_score[5]; // for some reason uart_printf does not support %d formatting so I have to use a string to display it...
-        itoa(top_score, new_top_score, 10);
-        uart_printf("The new top score is %s. Good job!\n", new_top_score);
-    }
-    score = 0;
-    _delay_ms(2500);
+    DirectLCD_printpos_P(4, 1, PSTR("Game over!"));
+    if (game.score > top_score) {
+        top_score = game.score;
+        uart_printf_P(PSTR("The new top score is %d. Good job!\n"), top_score);
+    }
+    if (jump_latency.jumps) {
+        uart_printf_P(PSTR("Jump latency: %u jumps, avg %lu us, max %lu us\n"), jump_latency.jumps,
+                      jump_latency.total_us / jump_latency.jumps, jump_latency.max_us);
+    }
+    matrix_anim_play(game_over_anim);
     num_rounds--;
 }
 
-unsigned long get_ms() {
-    return (unsigned long) ((cycle_count * 256.0 + TCNT2) * 8 / 16000.0);
+//  Start a round at time now on a cleared display
+void round_start(unsigned long now) {
+    game_reset(&game, now);
+    round_start_ms = now;
+    jump_latency = (struct input_latency) {0};
+    frame_dirty = 1;
+}
+
+void game_render(void) {
+    if (!frame_dirty) return;
+    frame_dirty = 0;
+    update_lcd();
+    print_score();
+    DirectLCD_flush();
+}
+
+//  Sleep until an ISR posts an event or the deadline passes. Timer2 wakes
+//  the CPU every millisecond, on the same tick that advances global_clock,
+//  so a deadline is seen on the tick that reaches it.
+//  The check runs with interrupts off and sei() takes effect only after the
+//  instruction that follows it, so the sleep instruction always runs before
+//  any interrupt can: one that arrives after the check wakes it instead of
+//  being missed.
+void game_idle(unsigned long deadline) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    for (EVER) {
+        cli();
+        if (event_head != event_tail || deadline_reached(global_clock, deadline)) {
+            sei();
+            return;
+        }
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
 }
 
 void game_loop(void) {
     while (num_rounds > 0) {
         DirectLCD_clear();
-        DirectLCD_print("Counting down...");
-        matrix_display_bmp3();
-        matrix_display_bmp2();
-        matrix_display_bmp1();
-        DirectLCD_print("Go!");
-        _delay_ms(300);
+        DirectLCD_print_P(PSTR("Counting down..."));
+        matrix_anim_play(countdown_anim);
+        matrix_clear();
+        DirectLCD_print_P(PSTR("Go!"));
+        hal_delay_ms(300);
         DirectLCD_clear();
+        apply_speed(speed_level); // The clear took the label with it
+        round_start(millis());
 
         while (continue_game) {
-            unsigned long cur_ms_cp = get_ms();
-            if (cur_ms_cp - prev_ms >= (unsigned long) scroll_speed) {
-                prev_ms = cur_ms_cp;
-                if (rand() % 10 > 8) {
-                    runner_area[15] = OBSTACLE;
-                } else {
-                    runner_area[15] = 32;
-                }
-                for (int i = 0; i <= 15; i++) {
-                    runner_area[i] = runner_area[i + 1];
-                }
-                if (stop_updates_to_score == 0) {
-                    score++;
-                }
-            }
-            draw_bounds();
-
-            if (pressed_select == 1) {
-                if ((runner_area[1] != 32) && (runner_area[1] != OBSTACLE)) {
-                runner_area[1] = 32;
+            uint8_t input = handle_events();
+            if (!continue_game) break;
+            unsigned long now = millis();
+            // game_step() only has work on input or at its deadline
+            if (input || deadline_reached(now, game_deadline(&game, select_held))) {
+                uint8_t result = game_step(&game, now, select_held);
+                if (result & GAME_MOVED) frame_dirty = 1;
+                if (result & GAME_OVER) {
+                    game_over();
+                    break;
                 }
-                jump = RUNNER;
-                stop_updates_to_score = 1;
-                jump_time = get_ms();
             }
-            if (get_ms() - jump_time >= (unsigned long) jump_dur) {
-                if (no_obstacle) {
-                runner_area[1] = RUNNER;
-                jump = 32;
-                stop_updates_to_score = 0;
-                } else {
-                game_over();
-                break;
-                }
-            }
-            update_lcd();
-            print_score();
+            game_render();
+            game_idle(game_deadline(&game, select_held));
         }
     }
     exit_screen();
 }
 
+// Host tools that drive the game themselves build with -DMICRODINO_NO_MAIN
+#ifndef MICRODINO_NO_MAIN
 int main() {
     //  ******************************************
     //     Initialisation sequence
     //  ******************************************
+    game_init(&game);
     uart_init(); // UART setup
     device_setup(); // Data direction registers and interrupts
+    matrix_setup(); // LED matrix scanner
   	DirectLCD_init();
     lcd_greeting();
     serial_greeting();
     game_loop();
+    DirectLCD_fence(); // Returning from main disables interrupts
+    uart_flush();
     return 0;
-}
\ No newline at end of file
+}
+#endif